@@ -0,0 +1,38 @@
+#pragma once
+
+#include "Include/peglib.h"
+
+// Interpreter state attached to every parse tree node through peglib's AstBase annotation.
+// Nodes specialize themselves after their first execution by recording a Quick kind here;
+// a failed guard drops them back to QGeneric for good.
+enum Quick : unsigned char {
+    QNone,        // not executed yet
+    QGeneric,     // deoptimized; always take the generic path
+    QNumber,      // NUMBER literal, value cached in `constant`
+    QExprValue,   // single operand passed through unchanged
+    QExprInt,     // int arithmetic; guard: first operand is an int
+    QExprString,  // string concatenation; guard: leading variable holds a string
+    QExprList,    // list concatenation; guard: leading variable holds a list
+    QExprRawList, // list concatenation starting with a list literal
+};
+
+// Static types assigned by the TypeChecker; TUnknown means "check at runtime".
+enum Type : unsigned char { TUnknown, TNil, TBool, TInt, TString, TList, TIntList, TFunction, TDict, TRange };
+
+// Resolved storage of a global variable, valid while the Env's version is unchanged.
+struct InlineCache {
+    const void* env = nullptr;
+    void* slot = nullptr;
+    unsigned long version = 0;
+};
+
+struct AstInfo {
+    Quick quick = QNone;
+    Type type = TUnknown;
+    bool typed = false;  // quick was chosen from static types, so its guard can be skipped
+    bool global = false; // NAME that is never bound outside the global Env
+    long constant = 0;
+    mutable InlineCache cache;
+};
+
+using Ast = peg::AstBase<AstInfo>;
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <sys/stat.h>
+
+#include "Ast.hpp"
+#include "MappedFile.hpp"
+
+// On-disk cache of optimized parse trees, in the spirit of .pyc files. Entries live in a
+// .minipycache directory next to the script, named by a hash of the source and the grammar,
+// so an edit to either simply misses. Loading maps the file and rebuilds the nodes with their
+// tokens pointing into the mapping, which therefore has to outlive the tree.
+//
+// Layout, all integers little-endian as written by the host:
+//   "MPYC" u32 format  u64 hash  u32 nameCount  { u32 len, bytes }*nameCount
+//   node := u32 name  u32 originalName  u32 line  u32 column  u32 position  u32 length
+//           u32 choiceCount  u32 choice  u32 originalChoiceCount  u32 originalChoice
+//           u8 isToken  then either { u32 len, bytes } or { u32 childCount, node* }
+namespace ast_cache {
+
+constexpr uint32_t Format = 1;
+
+inline uint64_t fnv1a(std::string_view s, uint64_t h = 0xcbf29ce484222325ull) {
+    for(unsigned char c : s)
+        h = (h ^ c) * 0x100000001b3ull;
+    return h;
+}
+
+inline std::string path_for(const std::string& script, uint64_t hash) {
+    auto slash = script.rfind('/');
+    std::string dir = (slash == std::string::npos ? std::string(".") : script.substr(0, slash)) + "/.minipycache";
+    char name[32];
+    std::snprintf(name, sizeof(name), "/%016llx.ast", (unsigned long long) hash);
+    return dir + name;
+}
+
+struct Writer {
+    std::string out;
+    std::vector<std::string> names;
+
+    void u32(uint32_t v) { out.append(reinterpret_cast<const char*>(&v), 4); }
+    void bytes(std::string_view s) {
+        u32(s.size());
+        out.append(s);
+    }
+    uint32_t name(const std::string& n) {
+        for(size_t i = 0; i < names.size(); i++)
+            if(names[i] == n) return i;
+        names.push_back(n);
+        return names.size() - 1;
+    }
+    void node(const Ast& ast) {
+        u32(name(ast.name));
+        u32(name(ast.original_name));
+        for(size_t v : {ast.line, ast.column, ast.position, ast.length, ast.choice_count, ast.choice,
+                        ast.original_choice_count, ast.original_choice})
+            u32(v);
+        out.push_back(ast.is_token);
+        if(ast.is_token) {
+            bytes(ast.token);
+        } else {
+            u32(ast.nodes.size());
+            for(auto& child : ast.nodes)
+                node(*child);
+        }
+    }
+};
+
+// Best effort: a cache that can't be written is just a slower next run.
+inline void save(const std::string& path, uint64_t hash, const Ast& ast) {
+    Writer w;
+    w.node(ast);
+    std::string header = "MPYC";
+    Writer h;
+    h.u32(Format);
+    h.out.append(reinterpret_cast<const char*>(&hash), 8);
+    h.u32(w.names.size());
+    for(auto& n : w.names)
+        h.bytes(n);
+
+    mkdir(path.substr(0, path.rfind('/')).c_str(), 0755);
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream f(tmp, std::ios::out | std::ios::binary | std::ios::trunc);
+        f << header << h.out << w.out;
+        if(!f)
+            return;
+    }
+    std::rename(tmp.c_str(), path.c_str()); // readers never see a partial file
+}
+
+struct Reader {
+    const char* p;
+    const char* end;
+    std::vector<std::string> names;
+    bool ok = true;
+
+    Reader(const char* p, const char* end) : p(p), end(end) {}
+
+    uint32_t u32() {
+        uint32_t v = 0;
+        if(end - p < 4) {
+            ok = false;
+            return 0;
+        }
+        std::memcpy(&v, p, 4);
+        p += 4;
+        return v;
+    }
+    std::string_view bytes() {
+        uint32_t n = u32();
+        if(!ok || (size_t) (end - p) < n) {
+            ok = false;
+            return {};
+        }
+        std::string_view s(p, n);
+        p += n;
+        return s;
+    }
+    const std::string& name(uint32_t i) {
+        static const std::string none;
+        if(i >= names.size()) {
+            ok = false;
+            return none;
+        }
+        return names[i];
+    }
+    std::shared_ptr<Ast> node(int depth = 0) {
+        auto& n = name(u32());
+        auto& original = name(u32());
+        size_t f[8];
+        for(auto& v : f)
+            v = u32();
+        if(!ok || p >= end || depth > 10000)
+            return ok = false, nullptr;
+        bool isToken = *p++;
+        std::shared_ptr<Ast> ast;
+        if(isToken) {
+            auto token = bytes();
+            ast = std::make_shared<Ast>("", f[0], f[1], n.c_str(), token, f[2], f[3], f[4], f[5]);
+        } else {
+            uint32_t count = u32();
+            std::vector<std::shared_ptr<Ast>> nodes;
+            for(uint32_t i = 0; ok && i < count; i++)
+                nodes.push_back(node(depth + 1));
+            if(!ok)
+                return nullptr;
+            ast = std::make_shared<Ast>("", f[0], f[1], n.c_str(), nodes, f[2], f[3], f[4], f[5]);
+        }
+        if(original != n) // a node optimize_ast collapsed into its only child
+            ast = std::make_shared<Ast>(*ast, original.c_str(), f[2], f[3], f[6], f[7]);
+        for(auto& child : ast->nodes)
+            child->parent = ast;
+        return ast;
+    }
+};
+
+// nullptr when the file is stale, truncated or from another format version.
+inline std::shared_ptr<Ast> load(const MappedFile& file, uint64_t hash) {
+    Reader r{file.data(), file.data() + file.size()};
+    if(file.size() < 16 || std::memcmp(r.p, "MPYC", 4) != 0)
+        return nullptr;
+    r.p += 4;
+    uint64_t stored;
+    if(r.u32() != Format)
+        return nullptr;
+    std::memcpy(&stored, r.p, 8);
+    r.p += 8;
+    if(stored != hash)
+        return nullptr;
+    uint32_t count = r.u32();
+    for(uint32_t i = 0; r.ok && i < count; i++)
+        r.names.emplace_back(r.bytes());
+    auto ast = r.ok ? r.node() : nullptr;
+    return r.ok && r.p == r.end ? ast : nullptr;
+}
+
+} // namespace ast_cache
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+// Typed native bindings: def(env, "clamp", [](long x, long lo, long hi) { ... }) deduces the
+// arity and parameter types from the callable's signature and registers a Native that
+// evaluates the argument nodes into a fixed-size array and converts them in place, so no
+// argument List is built per call. Arity and type errors carry the call's line:col.
+
+std::runtime_error script_error(const Ast& at, const string& msg) {
+    return std::runtime_error(std::to_string(at.line) + ":" + std::to_string(at.column) + ": " + msg);
+}
+
+// Host type <-> Value conversions. Parameters may be taken by value or const reference;
+// const Value& accepts anything.
+template<typename T> struct Bind;
+template<> struct Bind<long> {
+    static constexpr const char* name = "int";
+    static const long* from(const Value& v) { return std::get_if<long>(&v.v); }
+    static Value to(long l) { return Value(l); }
+};
+template<> struct Bind<bool> {
+    static constexpr const char* name = "bool";
+    static const bool* from(const Value& v) { return std::get_if<bool>(&v.v); }
+    static Value to(bool b) { return Value(b); }
+};
+template<> struct Bind<string> {
+    static constexpr const char* name = "string";
+    static const string* from(const Value& v) { return std::get_if<string>(&v.v); }
+    static Value to(string s) { return Value(std::move(s)); }
+};
+template<> struct Bind<List> {
+    static constexpr const char* name = "list";
+    static const List* from(const Value& v) { return std::get_if<List>(&v.v); }
+    static Value to(List l) { return Value(std::move(l)); }
+};
+template<> struct Bind<Value> {
+    static constexpr const char* name = "value";
+    static const Value* from(const Value& v) { return &v; }
+    static Value to(Value v) { return v; }
+};
+
+// Parameter list of a lambda or function object, read off its operator().
+template<typename F> struct Signature : Signature<decltype(&F::operator())> {};
+template<typename C, typename R, typename... A> struct Signature<R (C::*)(A...) const> {
+    using Result = R;
+    using Args = std::tuple<std::decay_t<A>...>;
+};
+template<typename C, typename R, typename... A> struct Signature<R (C::*)(A...)> : Signature<R (C::*)(A...) const> {};
+template<typename R, typename... A> struct Signature<R (*)(A...)> {
+    using Result = R;
+    using Args = std::tuple<std::decay_t<A>...>;
+};
+
+template<typename T>
+const T& bound_arg(const shared_ptr<Ast>& call, const Value& v, size_t i) {
+    if(auto p = Bind<T>::from(v))
+        return *p;
+    throw script_error(*call, "TypeError: " + call->nodes[0]->token_to_string() + "() argument " + std::to_string(i + 1)
+                                   + " must be " + Bind<T>::name + ", not " + Value::getTypeName(v.v.index()));
+}
+
+template<typename F, typename Args, size_t... I>
+Value invoke_bound(F& f, const shared_ptr<Ast>& call, const shared_ptr<Env>& env, std::index_sequence<I...>) {
+    constexpr size_t N = sizeof...(I);
+    if(call->nodes.size() - 1 != N)
+        throw script_error(*call, "TypeError: " + call->nodes[0]->token_to_string() + "() takes " + std::to_string(N)
+                                       + " arguments (" + std::to_string(call->nodes.size() - 1) + " given)");
+    std::array<Value, N> values{eval(call->nodes[I + 1], env)...}; // braced lists evaluate left to right
+    using Result = decltype(f(bound_arg<std::tuple_element_t<I, Args>>(call, values[I], I)...));
+    if constexpr (std::is_void_v<Result>) {
+        f(bound_arg<std::tuple_element_t<I, Args>>(call, values[I], I)...);
+        return Value();
+    } else {
+        return Bind<std::conditional_t<std::is_integral_v<Result> && !std::is_same_v<Result, bool>, long, std::decay_t<Result>>>::to(
+            f(bound_arg<std::tuple_element_t<I, Args>>(call, values[I], I)...));
+    }
+}
+
+template<typename F>
+Native bind_native(F f) {
+    using Args = typename Signature<F>::Args;
+    return [f = std::move(f)](const shared_ptr<Ast>& call, const shared_ptr<Env>& env) mutable {
+        return invoke_bound<F, Args>(f, call, env, std::make_index_sequence<std::tuple_size_v<Args>>());
+    };
+}
+
+template<typename F>
+void def(const shared_ptr<Env>& env, const string& name, F f) {
+    env->set_value(name, Value(bind_native(std::move(f))));
+}
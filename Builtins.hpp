@@ -0,0 +1,277 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Native builtin library registered in the global Env. The list mutators are Natives so they
+// can resolve their first argument to the variable's storage and grow it in place instead of
+// rebuilding the list through `l = l + [x]`.
+
+void check_arity(const char* fn, size_t got, size_t lo, size_t hi) {
+    if(got >= lo && got <= hi)
+        return;
+    string expected = lo == hi ? std::to_string(lo) : std::to_string(lo) + " to " + std::to_string(hi);
+    throw std::runtime_error(string("TypeError: ") + fn + "() takes " + expected + " arguments (" + std::to_string(got) + " given)");
+}
+
+// First argument of a list mutator: the list stored in the named variable.
+List& target_list(const shared_ptr<Ast>& call, const shared_ptr<Env>& env, const char* fn) {
+    auto& node = call->nodes[1];
+    if(node->tag != "NAME"_)
+        throw std::runtime_error(string("TypeError: ") + fn + "() expects a list variable as its first argument");
+    auto& list = name_slot(*node, *env).ref<List>();
+    if(list.size() == 1 && list[0].v.index() == 0) // `l = []` holds a single nil placeholder
+        list.clear();
+    return list;
+}
+
+long normalize_index(long index, size_t size) {
+    return index < 0 ? index + (long) size : index;
+}
+
+// LSD radix sort on the two's complement bytes with the sign bit flipped; passes where every
+// key shares the same byte are skipped.
+void radix_sort(vector<long>& keys) {
+    vector<long> tmp(keys.size());
+    for(int shift = 0; shift < 64; shift += 8) {
+        auto digit = [shift](long k) { return ((uint64_t(k) ^ (1ull << 63)) >> shift) & 0xff; };
+        size_t count[257] = {};
+        for(auto k : keys)
+            count[digit(k) + 1]++;
+        if(count[digit(keys[0]) + 1] == keys.size())
+            continue;
+        for(int i = 0; i < 256; i++)
+            count[i + 1] += count[i];
+        for(auto k : keys)
+            tmp[count[digit(k)]++] = k;
+        keys.swap(tmp);
+    }
+}
+
+List sort_values(const Value& seq) {
+    vector<long> ints;
+    vector<string> strs;
+    if(auto r = std::get_if<Range>(&seq.v))
+        ints.reserve(r->size());
+    for_each_item(seq, [&](const Value& v) {
+        if(auto l = std::get_if<long>(&v.v))
+            ints.push_back(*l);
+        else if(auto s = std::get_if<string>(&v.v))
+            strs.push_back(*s);
+        else
+            throw std::runtime_error("TypeError: sorted() cannot order " + Value::getTypeName(v.v.index()));
+        return true;
+    });
+    if(!ints.empty() && !strs.empty())
+        throw std::runtime_error("TypeError: sorted() cannot order int and string together");
+
+    List out;
+    if(!strs.empty()) {
+        std::sort(strs.begin(), strs.end());
+        out.reserve(strs.size());
+        for(auto& s : strs)
+            out.push_back(Value(std::move(s)));
+        return out;
+    }
+    if(ints.size() >= 256)
+        radix_sort(ints);
+    else
+        std::sort(ints.begin(), ints.end()); // introsort
+    out.reserve(ints.size());
+    for(auto l : ints)
+        out.push_back(Value(l));
+    return out;
+}
+
+// Ordering for ints and strings of the same kind.
+bool less_than(const Value& a, const Value& b) {
+    if(a.v.index() == 2)
+        return std::get<long>(a.v) < std::get<long>(b.v);
+    return std::get<string>(a.v) < std::get<string>(b.v);
+}
+
+// min()/max() accept either a single iterable or the values themselves.
+Value extreme(const char* fn, const List& args, bool wantMax) {
+    check_arity(fn, args.size(), 1, SIZE_MAX);
+    Value best;
+    auto visit = [&](const Value& v) {
+        if(v.v.index() != 2 && v.v.index() != 3)
+            throw std::runtime_error(string("TypeError: ") + fn + "() cannot order " + Value::getTypeName(v.v.index()));
+        if(best.v.index() != 0 && best.v.index() != v.v.index())
+            throw std::runtime_error(string("TypeError: ") + fn + "() cannot order int and string together");
+        if(best.v.index() == 0 || (wantMax ? less_than(best, v) : less_than(v, best)))
+            best = v;
+        return true;
+    };
+    if(args.size() == 1 && args[0].v.index() != 2 && args[0].v.index() != 3)
+        for_each_item(args[0], visit);
+    else
+        for_each_item(Value(args), visit);
+    if(best.v.index() == 0)
+        throw std::runtime_error(string("ValueError: ") + fn + "() arg is an empty sequence");
+    return best;
+}
+
+// Maps a data file for open_lines() / read_ints().
+Value open_file_lines(const string& path, bool ints) {
+    auto file = std::make_shared<MappedFile>();
+    if(!file->open(path))
+        throw std::runtime_error("FileNotFoundError: No such file: '" + path + "'");
+    return Value(FileLines{std::move(file), path, ints});
+}
+
+void register_builtins(const shared_ptr<Env>& global) {
+    // append(l, x): push x onto the list variable l.
+    global->set_value("append", Value(Native([](const shared_ptr<Ast>& call, const shared_ptr<Env>& env) {
+        check_arity("append", call->nodes.size() - 1, 2, 2);
+        auto item = eval(call->nodes[2], env);
+        auto& list = target_list(call, env, "append");
+        list.push_back(std::move(item));
+        resources.list_length(list.size());
+        return Value();
+    })));
+
+    // pop(l[, i]): remove and return the item at i, the last one by default.
+    global->set_value("pop", Value(Native([](const shared_ptr<Ast>& call, const shared_ptr<Env>& env) {
+        check_arity("pop", call->nodes.size() - 1, 1, 2);
+        long index = call->nodes.size() > 2 ? eval(call->nodes[2], env).get<long>() : -1;
+        auto& list = target_list(call, env, "pop");
+        if(list.empty())
+            throw std::runtime_error("IndexError: pop from empty list");
+        index = normalize_index(index, list.size());
+        if(index < 0 || index >= (long) list.size())
+            throw std::runtime_error("IndexError: pop index out of range");
+        Value item = std::move(list[index]);
+        list.erase(list.begin() + index);
+        return item;
+    })));
+
+    // extend(l, other): append every item of other.
+    global->set_value("extend", Value(Native([](const shared_ptr<Ast>& call, const shared_ptr<Env>& env) {
+        check_arity("extend", call->nodes.size() - 1, 2, 2);
+        auto other = eval(call->nodes[2], env);
+        auto& list = target_list(call, env, "extend");
+        if(auto items = std::get_if<List>(&other.v))
+            list.reserve(list.size() + items->size());
+        else if(auto r = std::get_if<Range>(&other.v))
+            list.reserve(list.size() + r->size());
+        for_each_item(other, [&](const Value& v) {
+            list.push_back(v);
+            return true;
+        });
+        resources.list_length(list.size());
+        return Value();
+    })));
+
+    // insert(l, i, x): insert x before index i.
+    global->set_value("insert", Value(Native([](const shared_ptr<Ast>& call, const shared_ptr<Env>& env) {
+        check_arity("insert", call->nodes.size() - 1, 3, 3);
+        long index = eval(call->nodes[2], env).get<long>();
+        auto item = eval(call->nodes[3], env);
+        auto& list = target_list(call, env, "insert");
+        index = std::clamp(normalize_index(index, list.size()), 0L, (long) list.size());
+        list.insert(list.begin() + index, std::move(item));
+        resources.list_length(list.size());
+        return Value();
+    })));
+
+    // range(stop) / range(start, stop[, step]): a lazy Range, see for_each_item.
+    global->set_value("range", Value(Function([](const List& args) {
+        check_arity("range", args.size(), 1, 3);
+        long start = args.size() > 1 ? args[0].get<long>() : 0;
+        long stop = args.size() > 1 ? args[1].get<long>() : args[0].get<long>();
+        long step = args.size() > 2 ? args[2].get<long>() : 1;
+        if(step == 0)
+            throw std::runtime_error("ValueError: range() arg 3 must not be zero");
+        return Value(Range{start, stop, step});
+    })));
+
+    // list(iterable): materialize a range, dict keys or string characters.
+    global->set_value("list", Value(Function([](const List& args) {
+        check_arity("list", args.size(), 1, 1);
+        List out;
+        if(auto r = std::get_if<Range>(&args[0].v))
+            out.reserve(r->size());
+        for_each_item(args[0], [&](const Value& v) {
+            out.push_back(v);
+            return true;
+        });
+        return Value(std::move(out));
+    })));
+
+    // open_lines(path) / read_ints(path): the lines or ints of a file, read lazily by for-in.
+    def(global, "open_lines", [](const string& path) { return open_file_lines(path, false); });
+    def(global, "read_ints", [](const string& path) { return open_file_lines(path, true); });
+
+    // write_lines(path, items): each item of a list, range or file on its own line. The lines go
+    // to path.tmp, renamed into place at the end, so `items` may be a mapping of path itself.
+    def(global, "write_lines", [](const string& path, const Value& items) {
+        static constexpr size_t BufferSize = 1 << 20;
+        std::unique_ptr<char[]> buffer(new char[BufferSize]);
+        string tmp = path + ".tmp";
+        std::ofstream os;
+        os.rdbuf()->pubsetbuf(buffer.get(), BufferSize); // before open, or libstdc++ ignores it
+        os.open(tmp, std::ios::out | std::ios::binary | std::ios::trunc);
+        if(!os)
+            throw std::runtime_error("OSError: could not open '" + path + "' for writing");
+        try {
+            StreamSink sink{os};
+            for_each_item(items, [&](const Value& v) {
+                v.write(sink);
+                sink.put('\n');
+                return true;
+            });
+            os.close();
+        } catch(...) {
+            std::remove(tmp.c_str());
+            throw;
+        }
+        if(!os || std::rename(tmp.c_str(), path.c_str()) != 0) {
+            std::remove(tmp.c_str());
+            throw std::runtime_error("OSError: could not write '" + path + "'");
+        }
+    });
+
+    def(global, "sorted", [](const Value& seq) { return sort_values(seq); });
+
+    global->set_value("min", Value(Function([](const List& args) {
+        return extreme("min", args, false);
+    })));
+
+    global->set_value("max", Value(Function([](const List& args) {
+        return extreme("max", args, true);
+    })));
+
+    def(global, "sum", [](const Value& seq) {
+        long total = 0;
+        for_each_item(seq, [&](const Value& v) {
+            total += v.get<long>();
+            return true;
+        });
+        return total;
+    });
+
+    def(global, "abs", [](long l) { return l < 0 ? -l : l; });
+
+    def(global, "str", [](const Value& v) { return v.str(); });
+
+    def(global, "int", [](const Value& v) {
+        if(auto b = std::get_if<bool>(&v.v))
+            return (long) *b;
+        if(auto s = std::get_if<string>(&v.v)) {
+            long l = 0;
+            auto first = s->data() + (s->size() && s->front() == '+');
+            auto res = std::from_chars(first, s->data() + s->size(), l);
+            if(res.ec != std::errc() || res.ptr != s->data() + s->size() || first == s->data() + s->size())
+                throw std::runtime_error("ValueError: invalid literal for int(): '" + *s + "'");
+            return l;
+        }
+        return v.get<long>();
+    });
+}
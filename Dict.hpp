@@ -0,0 +1,111 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "Resources.hpp"
+
+// Open addressing hash map behind the `dict` Value, laid out like a Swiss table: one control
+// byte per bucket holds 7 bits of the hash (or Empty) and is probed a group of 8 buckets at a
+// time with plain 64-bit word tricks. Buckets only store an entry index; keys and values live
+// densely in insertion order, which keeps the probed arrays small and iteration stable.
+//
+// Templated on the value type so it can sit inside Value's variant; hash_value() and
+// same_value() are found by ADL once V is complete.
+template<typename V>
+struct HashTable {
+    using Entries = std::vector<V, TrackedAllocator<V, RList>>;
+
+    static constexpr uint8_t Empty = 0x80;
+    static constexpr size_t GroupWidth = 8;
+
+    std::vector<uint8_t, TrackedAllocator<uint8_t, RDict>> ctrl;
+    std::vector<uint32_t, TrackedAllocator<uint32_t, RDict>> buckets; // entry index per bucket
+    std::vector<size_t, TrackedAllocator<size_t, RDict>> hashes;      // per entry, reused on rehash
+    Entries keys;
+    Entries values;
+
+    size_t size() const { return keys.size(); }
+
+    const V* find(const V& key) const {
+        long e = lookup(key, hash_value(key));
+        return e < 0 ? nullptr : &values[e];
+    }
+    // Inserts nil when the key is missing.
+    V& operator[](const V& key) {
+        size_t hash = hash_value(key);
+        long e = lookup(key, hash);
+        if(e >= 0)
+            return values[e];
+        if((keys.size() + 1) * 8 > ctrl.size() * 7) // keep the load factor under 7/8
+            rehash(std::max<size_t>(16, ctrl.size() * 2));
+        keys.push_back(key);
+        values.push_back(V());
+        hashes.push_back(hash);
+        place(hash, keys.size() - 1);
+        return values.back();
+    }
+    bool operator==(const HashTable& rhs) const {
+        if(size() != rhs.size())
+            return false;
+        for(size_t e = 0; e < keys.size(); e++) {
+            auto other = rhs.find(keys[e]);
+            if(!other || !same_value(values[e], *other))
+                return false;
+        }
+        return true;
+    }
+
+    static uint64_t match_byte(uint64_t group, uint8_t h2) {
+        uint64_t x = group ^ (0x0101010101010101ull * h2);
+        return (x - 0x0101010101010101ull) & ~x & 0x8080808080808080ull; // may over-report; keys are compared anyway
+    }
+    static uint64_t match_empty(uint64_t group) {
+        return group & 0x8080808080808080ull; // full buckets never have the top bit set
+    }
+    uint64_t load_group(size_t g) const {
+        uint64_t group;
+        std::memcpy(&group, ctrl.data() + g * GroupWidth, GroupWidth);
+        return group;
+    }
+
+    // Groups are visited in triangular steps, which covers every group of a power of two table.
+    long lookup(const V& key, size_t hash) const {
+        if(ctrl.empty())
+            return -1;
+        size_t mask = ctrl.size() / GroupWidth - 1;
+        size_t g = (hash >> 7) & mask;
+        for(size_t step = 1;; step++) {
+            uint64_t group = load_group(g);
+            for(uint64_t m = match_byte(group, hash & 0x7f); m; m &= m - 1) {
+                uint32_t e = buckets[g * GroupWidth + __builtin_ctzll(m) / 8];
+                if(hashes[e] == hash && same_value(keys[e], key))
+                    return e;
+            }
+            if(match_empty(group))
+                return -1;
+            g = (g + step) & mask;
+        }
+    }
+    void place(size_t hash, uint32_t entry) {
+        size_t mask = ctrl.size() / GroupWidth - 1;
+        size_t g = (hash >> 7) & mask;
+        for(size_t step = 1;; step++) {
+            if(uint64_t m = match_empty(load_group(g))) {
+                size_t b = g * GroupWidth + __builtin_ctzll(m) / 8;
+                ctrl[b] = hash & 0x7f;
+                buckets[b] = entry;
+                return;
+            }
+            g = (g + step) & mask;
+        }
+    }
+    void rehash(size_t capacity) {
+        ctrl.assign(capacity, Empty);
+        buckets.assign(capacity, 0);
+        for(size_t e = 0; e < keys.size(); e++)
+            place(hashes[e], e);
+    }
+};
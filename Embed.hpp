@@ -0,0 +1,99 @@
+#pragma once
+
+#include <memory>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "Include/peglib.h"
+#include "Interpreter.hpp"
+#include "TypeCheck.hpp"
+#include "Inline.hpp"
+#include "Grammar.hpp"
+
+// Embedding API: a Script is parsed, type checked and run once, after which its global
+// functions can be called from C++ any number of times without touching the parser again.
+//
+//     Script script(source);
+//     auto score = script.global("score");
+//     Value v = script.call(score, {Value(3L), Value(4L)});
+//
+// Trace and variable logs go nowhere unless streams are given.
+struct Script {
+    std::ostream discard{nullptr}; // no buffer: every write is dropped
+    peg::parser parser{minipython_grammar};
+    string text; // the parsed source; AST tokens point into it
+    shared_ptr<Ast> ast;
+    Interpreter interp;
+
+    explicit Script(const string& source, std::ostream& out = std::cout)
+        : Script(source, out, discard, discard, discard) {}
+    Script(const string& source, std::ostream& out, std::ostream& trace, std::ostream& var, std::ostream& error)
+        : interp(out, trace, var, error) {
+        string errors;
+        parser.set_logger([&](size_t line, size_t col, const string& msg, const string&) {
+            errors += std::to_string(line) + ":" + std::to_string(col) + ": " + msg + "\n";
+        });
+        parser.enable_ast<Ast>();
+        install_hooks(parser);
+        text = source;
+        if(!parser.parse(text, ast))
+            throw std::runtime_error("SyntaxError: " + errors);
+        ast = parser.optimize_ast(ast);
+        Inliner().run(ast);
+
+        TypeChecker checker;
+        checker.check(ast);
+        for(auto& e : checker.errors)
+            errors += std::to_string(e.line) + ":" + std::to_string(e.column) + ": " + e.message + "\n";
+        if(!errors.empty())
+            throw std::runtime_error(errors);
+        interp.run(ast); // top-level statements bind the globals
+    }
+    Script(const Script&) = delete;
+
+    Value global(const string& name) const {
+        return interp.global->get_value(name);
+    }
+
+    Value call(const Value& fn, List args) {
+        if(auto f = std::get_if<Function>(&fn.v))
+            return (*f)(args);
+        throw std::runtime_error("TypeError: '" + Value::getTypeName(fn.v.index()) + "' object is not callable from the host");
+    }
+
+    // Calls fn once per argument list. A user defined function runs every call in the same
+    // frame: parameters are rebound in place and other locals are dropped between calls, so
+    // no Env is allocated per call.
+    vector<Value> call_many(const Value& fn, const vector<List>& batch) {
+        vector<Value> results;
+        results.reserve(batch.size());
+        auto f = std::get_if<Function>(&fn.v);
+        auto user = f ? f->target<UserFunction>() : nullptr;
+        if(!user) {
+            for(auto& args : batch)
+                results.push_back(call(fn, args));
+            return results;
+        }
+        auto& decl = user->closure->decl;
+        size_t params = decl->nodes.size() - 2; // name ... block
+        auto frame = make_env(user->closure->env);
+        for(auto& args : batch) {
+            if(args.size() != params)
+                throw std::runtime_error("TypeError: " + user->closure->name + "() takes " + std::to_string(params) 
+                                         + " arguments (" + std::to_string(args.size()) + " given)");
+            results.push_back(user->run(args, frame));
+            if(frame->values.size() > params) {
+                for(auto it = frame->values.begin(); it != frame->values.end();) {
+                    bool param = false;
+                    for(size_t i = 0; i < params && !param; i++)
+                        param = decl->nodes[1 + i]->token == it->first;
+                    it = param ? std::next(it) : frame->values.erase(it);
+                }
+            }
+        }
+        return results;
+    }
+};
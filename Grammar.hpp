@@ -0,0 +1,150 @@
+#pragma once
+
+#include <algorithm>
+#include <any>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Include/peglib.h"
+#include "Ast.hpp"
+
+// PEG grammar of the language, shared by the driver and the embedding API. Indentation is
+// part of the grammar: every block's first line sets its level through Indent, and Samedent
+// only matches lines at the innermost level. The level stack lives in the rule hooks set up by
+// install_hooks(), which every parser built from this grammar needs. A program is a sequence of
+// top-level items, which the pipelined mode (Pipeline.hpp) parses one at a time.
+// https://bford.info/pub/lang/peg.pdf
+const char* const minipython_grammar = R"(
+        program         <- (Blanks item)* Blanks EOF
+        item            <- function / stmt
+        
+        indent_block    <- EOL block
+        block           <- Blank* Indent statement (Blank* Samedent statement)* { no_ast_opt }
+        function        <- ('def' __ NAME __'(' _ Args(NAME)? ')' __ ':' (Lazy EOL lazy_block / indent_block))
+        lazy_block      <- < Blank* BodyLine (Blank / BodyLine)* >
+        lazy_body       <- block Blanks EOF   # a lazy_block's text, parsed on the first call
+
+        stmt            <- while / for / if / (list_expr / assignment / call) ';'? EOL
+        statement       <- while / for / if / (list_expr / assignment / call / return_stmt) ';'? EOL
+
+        list_expr       <- list_assign / list_create
+        list_assign     <- (NAME '[' _ (list_op / expression) _ ']' _ '=' _ expression)
+        list_create     <- NAME '=' _ &ListAhead '[' _ Args(expression)? ']' _ !term_op { no_ast_opt }
+        assignment      <- NAME '=' _ expression
+        call            <- NAME '(' _ Args(call / VALUE / expression)? ')' _ { no_ast_opt }
+
+        if              <- 'if' __ compare ':' indent_block (Blank* Samedent 'else' _ ':' indent_block)?
+        compare         <-  (compare_prefix VALUE) / ((VALUE compare_infix ' '* VALUE)) / ('(' (VALUE compare_infix ' '* VALUE) ')')
+        compare_prefix  <- 'not' __
+        compare_infix   <- '==' / '!=' / '<=' / '>=' / '<' / '>' / 'and' / 'or'
+
+        while           <- 'while' __ '(' _ compare _ ')' _ ':'  indent_block
+        for             <- 'for' __ NAME 'in' __ expression ':' indent_block
+        return_stmt     <- 'return' _ expression { no_ast_opt }
+
+        expression      <- sign term (term_op term)*
+        sign            <- < [-+]? > _
+        term_op         <- < [-+] > _
+        term            <- factor (factor_op factor)*
+        factor_op       <- < [*/] > _
+        factor          <- VALUE / '(' _ expression ')' _
+        VALUE           <- list_comp / raw_list / dict / list_value / call / STRING / NAME / NUMBER
+        
+        raw_list        <- _ '[' _ Args(expression / VALUE)? ']' _ { no_ast_opt }
+        list_comp       <- &CompAhead _ '[' _ expression _ 'for' __ NAME 'in' __ expression _ ('if' __ compare _)? ']' _ { no_ast_opt }
+        dict            <- '{' _ Args(dict_item)? '}' _ { no_ast_opt }
+        dict_item       <- expression ':' _ expression
+        list_value      <- NAME '[' _ (':'/ list_op) ']' _
+        list_op         <- list_splice / (NUMBER / NAME / STRING) &']' / expression
+        list_splice     <- &SpliceAhead leftSp? ':' rightSp? { no_ast_opt }
+        leftSp          <- expression { no_ast_opt }
+        rightSp         <- expression { no_ast_opt }
+        
+        
+        keyword         <- ('while' / 'if' / 'def' / 'for' / 'in' / 'not') ![a-zA-Z0-9_]
+        
+        STRING          <- '"' < (!'"' .)* > '"'
+        NAME            <- !keyword < [a-zA-Z_] [a-zA-Z0-9_]* > _
+        NUMBER          <- < [0-9]+ > _
+
+
+        # Bracket-matching scans that pick between alternatives sharing a prefix (list_comp and
+        # raw_list, list_create and assignment, list_splice and an index) before any of them
+        # parses it, so no text is parsed twice and nesting stays linear without packrat.
+        ~CompAhead      <- _ '[' Scan* 'for' ![a-zA-Z0-9_]
+        ~ListAhead      <- !CompAhead '[' Inner* ']' _ !term_op
+        ~SpliceAhead    <- Scan* ':'
+        ~Scan           <- !('for' ![a-zA-Z0-9_]) (Nested / [a-zA-Z_] [a-zA-Z0-9_]* / ![\])}:\r\n] .)
+        ~Nested         <- '[' Inner* ']' / '(' Inner* ')' / '{' Inner* '}' / '"' (!'"' .)* '"'
+        ~Inner          <- Nested / ![\])}\r\n] .
+
+        ~Lazy           <- ''
+        ~BodyLine       <- ' '+ [^\r\n]* (NEWLINE / EOF)
+        ~Indent         <- ' '*
+        ~Samedent       <- ' '*
+        Args(x)         <- x _ (',' _ x)*
+        ~Comment        <- '#' [^\r\n]* _
+        ~Blanks         <- Blank*
+        ~Blank          <- _ Comment? NEWLINE
+        ~EOL            <- _ Comment? (NEWLINE / EOF)
+        ~NEWLINE        <- '\r'? '\n'
+        ~_              <- [ \t]*
+        ~__             <- ![a-z0-9_] _
+        ~EOF            <- !.
+    )";
+
+// The hooks make rule results depend on the level stack, which packrat memoization would
+// cache across (a failed Samedent at a dedent is retried at the same position by the outer
+// block), so parsers of this grammar run without packrat parsing; the *Ahead scans in the
+// grammar keep that linear.
+//
+// With lazyBodies, a def only skims its body: the indented lines after it become a
+// lazy_block token, which parse_lazy_body() turns into the block on the function's first call.
+inline void install_hooks(peg::parser& parser, bool lazyBodies = false) {
+    parser["Lazy"].predicate = [lazyBodies](const peg::SemanticValues&, const std::any&, std::string&) {
+        return lazyBodies;
+    };
+
+    auto levels = std::make_shared<std::vector<size_t>>();
+    auto top = [levels](const peg::Context&, const char*, size_t, std::any&) {
+        levels->assign(1, 0);
+    };
+    parser["item"].enter = top;
+    parser["lazy_body"].enter = top;
+    parser["block"].enter = [levels](const peg::Context&, const char*, size_t, std::any&) {
+        levels->push_back(0); // set by the block's Indent
+    };
+    parser["block"].leave = [levels](const peg::Context&, const char*, size_t, size_t, std::any&, std::any&) {
+        levels->pop_back();
+    };
+    parser["Indent"].predicate = [levels](const peg::SemanticValues& vs, const std::any&, std::string& msg) {
+        if(vs.sv().size() <= (*levels)[levels->size() - 2]) {
+            msg = "expected an indented block";
+            return false;
+        }
+        levels->back() = vs.sv().size();
+        return true;
+    };
+    parser["Samedent"].predicate = [levels](const peg::SemanticValues& vs, const std::any&, std::string& msg) {
+        size_t n = vs.sv().size();
+        if(n == levels->back())
+            return true;
+        if(n > levels->back())
+            msg = "unexpected indent";
+        else if(std::find(levels->begin(), levels->end(), n) == levels->end())
+            msg = "unindent does not match any outer indentation level";
+        return false;
+    };
+}
+
+// The block a full parse builds for a body skimmed into `lazy`, with the same positions; nullptr
+// after a syntax error, which goes to the parser's logger.
+inline std::shared_ptr<Ast> parse_lazy_body(const peg::parser& parser, const Ast& lazy) {
+    const char* source = lazy.token.data() - lazy.position;
+    std::shared_ptr<Ast> block;
+    size_t len = 0;
+    if(!parser.parse_prefix("lazy_body", source, lazy.position + lazy.token.size(), lazy.position, lazy.line, block, len))
+        return nullptr;
+    return parser.optimize_ast(block);
+}
@@ -0,0 +1,222 @@
+#pragma once
+
+#include <istream>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "Ast.hpp"
+
+using namespace peg::udl;
+
+// AST inlining of small helpers. A top-level `def f(a, b): return <expr>` is substituted into
+// its call sites as a copy of <expr> with the parameters replaced by the call's arguments, so
+// the call no longer costs a Function call, an Env and the parameter copies.
+//
+// Only done where that can't change what the code means:
+//  - f is bound once in the whole program, by a top-level def, and its body doesn't call f;
+//  - the body's other names are only ever bound in the global Env, so they resolve the same
+//    from any call site, and it doesn't call the in-place list mutators;
+//  - every argument is a variable or a literal, so duplicating or reordering it is harmless,
+//    and the arity matches;
+//  - the result isn't discarded and isn't the operand of a unary sign.
+// Copies are made from the original bodies, so inlined code is never inlined again and
+// recursion through other helpers stays bounded.
+struct InlineOptions {
+    size_t budget = 24;               // nodes in the return expression
+    size_t hotBudget = 96;            // for functions sampled in a previous run's profile
+    std::map<std::string, size_t> calls; // profile samples per function; empty means unprofiled
+};
+
+// Reads --profile output ("<module>:3:1;fib:4:5;... 42") into samples per function name.
+std::map<std::string, size_t> read_profile_counts(std::istream& is) {
+    std::map<std::string, size_t> counts;
+    std::string line;
+    while(std::getline(is, line)) {
+        auto space = line.rfind(' ');
+        if(space == std::string::npos)
+            continue;
+        size_t n = std::stoul(line.substr(space + 1));
+        std::set<std::string> seen; // count each function once per stack
+        for(size_t start = 0; start < space;) {
+            size_t end = std::min(line.find(';', start), space);
+            auto frame = line.substr(start, end - start);
+            auto name = frame.substr(0, frame.find(':'));
+            if(name != "<module>" && seen.insert(name).second)
+                counts[name] += n;
+            start = end + 1;
+        }
+    }
+    return counts;
+}
+
+struct Inliner {
+    struct Candidate {
+        std::shared_ptr<Ast> decl;
+        std::shared_ptr<Ast> body; // the return expression
+    };
+
+    InlineOptions options;
+    std::map<std::string, Candidate> candidates;
+    size_t inlined = 0;
+
+    static size_t count_nodes(const std::shared_ptr<Ast>& node) {
+        size_t n = 1;
+        for(auto& child : node->nodes)
+            n += count_nodes(child);
+        return n;
+    }
+    static void count_bindings(const std::shared_ptr<Ast>& node, bool inFunction, std::map<std::string, size_t>& bindings,
+                               std::set<std::string>& locals) {
+        switch(node->tag) {
+            case "function"_:
+                bindings[node->nodes[0]->token_to_string()]++;
+                if(inFunction)
+                    locals.insert(node->nodes[0]->token_to_string());
+                for(size_t i = 1; i + 1 < node->nodes.size(); i++)
+                    locals.insert(node->nodes[i]->token_to_string());
+                inFunction = true;
+                break;
+            case "assignment"_: case "list_create"_: case "for"_:
+                bindings[node->nodes[0]->token_to_string()]++;
+                if(inFunction)
+                    locals.insert(node->nodes[0]->token_to_string());
+                break;
+            case "list_comp"_:
+                locals.insert(node->nodes[1]->token_to_string());
+                break;
+        }
+        for(auto& child : node->nodes)
+            count_bindings(child, inFunction, bindings, locals);
+    }
+
+    // Whether the body only reads parameters and global-only names, and leaves f and the
+    // list mutators alone.
+    static bool self_contained(const std::shared_ptr<Ast>& node, const std::string& fn, const std::set<std::string>& params,
+                               const std::set<std::string>& locals) {
+        if(node->tag == "list_comp"_)
+            return false; // binds its own variable
+        if(node->tag == "NAME"_) {
+            auto name = node->token_to_string();
+            if(!params.count(name) && locals.count(name))
+                return false;
+        }
+        if(node->tag == "call"_) {
+            auto callee = node->nodes[0]->token_to_string();
+            if(callee == fn || callee == "append" || callee == "extend" || callee == "insert" || callee == "pop")
+                return false;
+        }
+        for(auto& child : node->nodes)
+            if(!self_contained(child, fn, params, locals))
+                return false;
+        return true;
+    }
+
+    void find_candidates(const std::shared_ptr<Ast>& program) {
+        std::map<std::string, size_t> bindings;
+        std::set<std::string> locals;
+        count_bindings(program, false, bindings, locals);
+        for(auto& decl : program->nodes) {
+            if(decl->tag != "function"_)
+                continue;
+            auto name = decl->nodes[0]->token_to_string();
+            auto& block = decl->nodes.back();
+            if(bindings[name] != 1 || locals.count(name) || block->nodes.size() != 1 || block->nodes[0]->tag != "return_stmt"_)
+                continue;
+            auto& body = block->nodes[0]->nodes[0];
+            bool hot = options.calls.count(name) && options.calls.at(name) > 0;
+            if(!options.calls.empty() && !hot)
+                continue; // profiled, and never seen running
+            if(count_nodes(body) > (hot ? options.hotBudget : options.budget))
+                continue;
+            std::set<std::string> params;
+            for(size_t i = 1; i + 1 < decl->nodes.size(); i++)
+                params.insert(decl->nodes[i]->token_to_string());
+            if(self_contained(body, name, params, locals))
+                candidates[name] = {decl, body};
+        }
+    }
+
+    // Deep copy with fresh interpreter state; parameter NAMEs become copies of the arguments.
+    static std::shared_ptr<Ast> instantiate(const std::shared_ptr<Ast>& node, const std::map<std::string, std::shared_ptr<Ast>>& args) {
+        if(node->tag == "NAME"_) {
+            if(auto it = args.find(node->token_to_string()); it != args.end())
+                return instantiate(it->second, {});
+        }
+        auto copy = std::make_shared<Ast>(*node);
+        static_cast<AstInfo&>(*copy) = AstInfo();
+        for(auto& child : copy->nodes) {
+            child = instantiate(child, args);
+            child->parent = copy;
+        }
+        return copy;
+    }
+
+    // The expression to put in place of `call`, or nullptr when it has to stay a call.
+    std::shared_ptr<Ast> expand(const std::shared_ptr<Ast>& call) {
+        auto it = candidates.find(call->nodes[0]->token_to_string());
+        if(it == candidates.end())
+            return nullptr;
+        auto& decl = it->second.decl;
+        if(call->nodes.size() != decl->nodes.size() - 1) // name + args vs name + params + block
+            return nullptr;
+        std::map<std::string, std::shared_ptr<Ast>> args;
+        for(size_t i = 1; i < call->nodes.size(); i++) {
+            auto& arg = call->nodes[i];
+            if(arg->tag != "NAME"_ && arg->tag != "NUMBER"_ && arg->tag != "STRING"_)
+                return nullptr;
+            if(arg->tag != "NAME"_ && used_as_name(it->second.body, decl->nodes[i]->token_to_string()))
+                return nullptr;
+            args[decl->nodes[i]->token_to_string()] = arg;
+        }
+        inlined++;
+        return instantiate(it->second.body, args);
+    }
+    // A parameter used as a list or callee needs a variable argument, and so does one leading
+    // an expression: that operand decides between arithmetic and concatenation by being a NAME.
+    static bool used_as_name(const std::shared_ptr<Ast>& node, const std::string& param) {
+        if((node->tag == "list_value"_ || node->tag == "call"_) && node->nodes[0]->token == param)
+            return true;
+        if(node->tag == "expression"_ && node->nodes[1]->tag == "NAME"_ && node->nodes[1]->token == param)
+            return true;
+        for(auto& child : node->nodes)
+            if(used_as_name(child, param))
+                return true;
+        return false;
+    }
+
+    void rewrite(const std::shared_ptr<Ast>& node) {
+        for(size_t i = 0; i < node->nodes.size(); i++) {
+            auto& child = node->nodes[i];
+            if(child->tag == "function"_ && candidates.count(child->nodes[0]->token_to_string()))
+                continue; // keep the bodies being copied from as they are
+            rewrite(child);
+            if(child->tag == "expression"_ && child->nodes.size() == 2 && child->nodes[1]->tag == "call"_) {
+                // `x = f(a)`: the inlined expression replaces the whole single-operand expression,
+                // unless a sign would now apply to it.
+                if(child->nodes[0]->token.empty())
+                    if(auto body = expand(child->nodes[1])) {
+                        body->parent = node;
+                        child = body;
+                    }
+                continue;
+            }
+            bool statement = node->tag == "program"_ || node->tag == "block"_;
+            bool signedOperand = node->tag == "expression"_ && node->nodes.size() == 2; // `-f(a)` passes f's result through
+            if(child->tag == "call"_ && !statement && !signedOperand)
+                if(auto body = expand(child)) {
+                    body->parent = node;
+                    child = body;
+                }
+        }
+    }
+
+    size_t run(const std::shared_ptr<Ast>& program) {
+        find_candidates(program);
+        if(!candidates.empty())
+            rewrite(program);
+        return inlined;
+    }
+};
@@ -1,15 +1,25 @@
 #pragma once
 
 #include <string>
+#include <charconv>
+#include <cstring>
 #include <functional>
 #include <variant>
 #include <memory>
+#include <set>
 #include <unordered_map>
 #include <vector>
 #include <iostream>
 #include <fstream>
 
 #include "Include/peglib.h"
+#include "Ast.hpp"
+#include "Profiler.hpp"
+#include "Stats.hpp"
+#include "Resources.hpp"
+#include "Output.hpp"
+#include "Dict.hpp"
+#include "MappedFile.hpp"
 
 using std::string;
 using std::function;
@@ -17,7 +27,6 @@ using std::vector;
 using std::nullptr_t;
 using std::shared_ptr;
 
-using namespace peg;
 using namespace peg::udl;
 
 std::ostream* traceLog;
@@ -27,12 +36,41 @@ std::ostream* errorLog;
 
 // Original intepretor credit: yhirose; modified to work w/ python.
 struct Value;
-using List = vector<Value>;
+using List = vector<Value, TrackedAllocator<Value, RList>>;
 using Function = function<Value(List&)>;
+struct Env;
+// Builtins that need their argument nodes unevaluated, e.g. to mutate a list variable in place.
+using Native = function<Value(const shared_ptr<Ast>& call, const shared_ptr<Env>& env)>;
+using Dict = HashTable<Value>;
+
+// Lazy arithmetic progression produced by range(); never materialized by for-in.
+struct Range {
+    long start, stop, step;
+
+    size_t size() const {
+        if(step > 0 ? start >= stop : start <= stop)
+            return 0;
+        return step > 0 ? (stop - start + step - 1) / step : (start - stop - step - 1) / -step;
+    }
+    long at(size_t i) const {
+        return start + (long) i * step;
+    }
+    bool operator==(const Range& rhs) const {
+        return start == rhs.start && stop == rhs.stop && step == rhs.step;
+    }
+};
+
+// Lazy view of a mapped text file produced by open_lines() and read_ints(); for-in reads it a
+// line or number at a time, see for_each_line. Copies share the mapping.
+struct FileLines {
+    shared_ptr<const MappedFile> file;
+    string path;
+    bool ints;
+};
 
 // The class that will hold all our interpreter values. Value can take any of the defined forms below. 
 struct Value {
-    std::variant<nullptr_t, bool, long, string, Function, List> v;
+    std::variant<nullptr_t, bool, long, string, Function, List, Native, Dict, Range, FileLines> v;
     Value() 
         : v(nullptr) {}
 
@@ -41,16 +79,81 @@ struct Value {
     explicit Value(long l) 
         : v(l) {}
     explicit Value(string s) 
-        : v(s) {}
+        : v(s) { stats.valueAllocs++; account(true); }
     explicit Value(Function f) 
-        : v(std::move(f)) {}
+        : v(std::move(f)) { stats.valueAllocs++; }
     explicit Value(List l) 
-        : v(std::move(l)) {}
+        : v(std::move(l)) { stats.valueAllocs++; resources.list_length(std::get<List>(v).size()); }
+    explicit Value(Native f) 
+        : v(std::move(f)) {}
+    explicit Value(Dict d) 
+        : v(std::move(d)) { stats.valueAllocs++; }
+    explicit Value(Range r) 
+        : v(r) {}
+    explicit Value(FileLines f) 
+        : v(std::move(f)) {}
+
+    // String buffers are not allocator-aware, so Values report them to the resource accounting.
+    Value(const Value& rhs) 
+        : v(accounted_copy(rhs.v)) {}
+    Value(Value&& rhs) noexcept 
+        : v(std::move(rhs.v)) {} // buffer ownership (and its accounting) moves with the string
+    Value& operator=(const Value& rhs) {
+        if(this != &rhs) {
+            auto copy = accounted_copy(rhs.v); // may throw; this Value is still untouched
+            account(false);
+            v = std::move(copy);
+        }
+        return *this;
+    }
+    Value& operator=(Value&& rhs) noexcept {
+        if(this != &rhs) {
+            account(false);
+            rhs.account(false);
+            v = std::move(rhs.v);
+            account(true);
+            rhs.account(true);
+        }
+        return *this;
+    }
+    ~Value() { account(false); }
+
+    // Copy of `from` whose string buffer is reserved before it is allocated, as TrackedAllocator
+    // does for containers; the new owner carries that reservation.
+    static decltype(v) accounted_copy(const decltype(v)& from) {
+        auto s = std::get_if<string>(&from);
+        if(!s || s->size() <= string().capacity())
+            return from; // fits inline, nothing on the heap
+        resources.reserve(RString, s->size() + 1);
+        try {
+            string copy(*s);
+            if(copy.capacity() > s->size()) // a library that rounds the buffer up
+                resources.reserve(RString, copy.capacity() - s->size());
+            return decltype(v)(std::move(copy));
+        } catch(...) {
+            resources.release(s->size() + 1);
+            throw;
+        }
+    }
+
+    void account(bool acquire) const {
+        if(auto s = std::get_if<string>(&v)) {
+            auto obj = reinterpret_cast<const char*>(s);
+            if(s->data() >= obj && s->data() < obj + sizeof(string))
+                return; // short string stored inline
+            if(acquire) 
+                resources.reserve(RString, s->capacity() + 1);
+            else 
+                resources.release(s->capacity() + 1);
+        }
+    }
 
 
     // Fetch
     template<typename T>
     T get() const {
+        if constexpr (std::is_same_v<T, List>)
+            stats.listCopies++;
         try {
             return std::get<T>(v);
         } catch (const std::bad_variant_access& e) {
@@ -61,6 +164,19 @@ struct Value {
             throw std::runtime_error(msg);
         }
     }
+    // Fetch in place, without copying containers.
+    template<typename T>
+    T& ref() {
+        if(auto p = std::get_if<T>(&v))
+            return *p;
+        string msg = "TypeError: Got unexpected type " + getTypeName(v.index());
+        *errorLog << msg;
+        throw std::runtime_error(msg);
+    }
+    template<typename T>
+    const T& ref() const {
+        return const_cast<Value*>(this)->ref<T>();
+    }
     // Equality check.
     bool operator==(const Value& rhs) const {
         switch (v.index()) {
@@ -71,10 +187,15 @@ struct Value {
             case 2:
                 return get<long>() == rhs.get<long>();
             case 3:
-                return get<string>() == rhs.get<string>();
+                return ref<string>() == rhs.ref<string>();
             case 5:
-                return get<List>() == rhs.get<List>();
+                return ref<List>() == rhs.ref<List>();
+            case 7:
+                return ref<Dict>() == rhs.ref<Dict>();
+            case 8:
+                return ref<Range>() == rhs.ref<Range>();
         }
+        return false; // functions never compare equal
     }
     // For printing
     static string getTypeName(int type) {
@@ -91,69 +212,327 @@ struct Value {
                 return "function";
             case 5: 
                 return "list";
+            case 6:
+                return "function";
+            case 7:
+                return "dict";
+            case 8:
+                return "range";
+            case 9:
+                return "file";
         }
         return "Unknown";
     }
-    // For printing
-    string str() const {
+    // For printing; formats straight into the sink without building intermediate strings.
+    template<typename Sink>
+    void write(Sink& out) const {
         switch (v.index()) {
             case 0:
-                return "nil";
+                out.write("nil", 3);
+                break;
             case 1:
-                return get<bool>() ? "true" : "false";
+                if(std::get<bool>(v)) out.write("true", 4);
+                else out.write("false", 5);
+                break;
             case 2:
-                return std::to_string(get<long>());
-            case 3:
-                return string(get<string>());
-            case 4:
-                return "Function";
+                out.write(std::get<long>(v));
+                break;
+            case 3: {
+                auto& s = std::get<string>(v);
+                out.write(s.data(), s.size());
+                break;
+            }
+            case 4: case 6:
+                out.write("Function", 8);
+                break;
             case 5: {
-                string out = "[";
-                auto list = get<List>();
-                for(int i = 0; i < list.size() - 1; i ++) {
-                    if(list[i].v.index() != 0)
-                        out = out + list[i].str() + ", ";
+                auto& list = std::get<List>(v);
+                out.put('[');
+                for(size_t i = 0; i + 1 < list.size(); i ++) {
+                    if(list[i].v.index() != 0) {
+                        list[i].write(out);
+                        out.write(", ", 2);
+                    }
+                }
+                if(!list.empty())
+                    list.back().write(out);
+                out.put(']');
+                break;
+            }
+            case 7: {
+                auto& dict = std::get<Dict>(v);
+                out.put('{');
+                for(size_t i = 0; i < dict.size(); i ++) {
+                    if(i) out.write(", ", 2);
+                    dict.keys[i].write(out);
+                    out.write(": ", 2);
+                    dict.values[i].write(out);
+                }
+                out.put('}');
+                break;
+            }
+            case 8: {
+                auto& r = std::get<Range>(v);
+                out.write("range(", 6);
+                out.write(r.start);
+                out.write(", ", 2);
+                out.write(r.stop);
+                if(r.step != 1) {
+                    out.write(", ", 2);
+                    out.write(r.step);
                 }
-                out = out + list.back().str() + "]";
-                return out;
+                out.put(')');
+                break;
+            }
+            case 9: {
+                auto& f = std::get<FileLines>(v);
+                out.write(f.ints ? "<ints of '" : "<lines of '", f.ints ? 10 : 11);
+                out.write(f.path.data(), f.path.size());
+                out.write("'>", 2);
+                break;
             }
+            default:
+                out.put('?');
         }
-        return "?";
+    }
+    string str() const {
+        string out;
+        StringSink sink{out};
+        write(sink);
+        return out;
     }
 };
 
+// Dict key support.
+bool same_value(const Value& a, const Value& b) {
+    return a.v.index() == b.v.index() && a == b;
+}
+size_t hash_value(const Value& val) {
+    size_t h = 0;
+    switch (val.v.index()) {
+        case 0:
+            break;
+        case 1:
+            h = std::get<bool>(val.v);
+            break;
+        case 2:
+            h = std::get<long>(val.v);
+            break;
+        case 3:
+            h = std::hash<string>()(std::get<string>(val.v));
+            break;
+        case 5:
+            for(auto& item : std::get<List>(val.v))
+                h = h * 31 + hash_value(item);
+            break;
+        default:
+            throw std::runtime_error("TypeError: unhashable type: '" + Value::getTypeName(val.v.index()) + "'");
+    }
+    h += val.v.index(); // splitmix64 finalizer; the control bytes need well mixed low bits
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+    return h ^ (h >> 31);
+}
+
+// Walks a mapped file a line (without its line break) or a whitespace separated int at a
+// time. Only the current item is copied out, and the pages already read are released every
+// few megabytes, so a file of any size runs in constant memory.
+template<typename F>
+void for_each_line(const FileLines& lines, F&& f) {
+    constexpr size_t ReleaseEvery = 16 << 20;
+    const char* begin = lines.file->data();
+    const char* end = begin + lines.file->size();
+    size_t released = 0;
+    for(const char* p = begin; p < end;) {
+        if(size_t(p - begin) - released >= ReleaseEvery) {
+            lines.file->release(released, p - begin);
+            released = p - begin;
+        }
+        if(!lines.ints) {
+            auto eol = static_cast<const char*>(memchr(p, '\n', end - p));
+            const char* stop = eol ? eol : end;
+            size_t n = stop - p - (stop > p && stop[-1] == '\r');
+            if(!f(Value(string(p, n))))
+                return;
+            p = eol ? eol + 1 : end;
+            continue;
+        }
+        while(p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+            p++;
+        if(p == end)
+            break;
+        const char* word = p;
+        while(p < end && !(*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+            p++;
+        long l = 0;
+        auto first = word + (*word == '+');
+        auto res = std::from_chars(first, p, l);
+        if(res.ec != std::errc() || res.ptr != p || first == p)
+            throw std::runtime_error("ValueError: invalid literal for int() in " + lines.path + ": '" + string(word, p - word) + "'");
+        if(!f(Value(l)))
+            return;
+    }
+}
+
+// Iteration protocol shared by for-in and the builtins: lists (skipping nil placeholders),
+// ranges, dict keys, the characters of a string and the lines or ints of a file. The callback
+// returns false to stop early.
+template<typename F>
+void for_each_item(const Value& val, F&& f) {
+    switch (val.v.index()) {
+        case 3:
+            for(char c : std::get<string>(val.v))
+                if(!f(Value(string(1, c)))) return;
+            break;
+        case 5:
+            for(auto& item : std::get<List>(val.v))
+                if(item.v.index() != 0 && !f(item)) return;
+            break;
+        case 7:
+            for(auto& key : std::get<Dict>(val.v).keys)
+                if(!f(key)) return;
+            break;
+        case 8: {
+            auto& r = std::get<Range>(val.v);
+            for(size_t i = 0, n = r.size(); i < n; i++)
+                if(!f(Value(r.at(i)))) return;
+            break;
+        }
+        case 9:
+            for_each_line(std::get<FileLines>(val.v), f);
+            break;
+        default:
+            throw std::runtime_error("TypeError: '" + Value::getTypeName(val.v.index()) + "' object is not iterable");
+    }
+}
+
+std::ostream& operator<<(std::ostream& os, const Value& val) {
+    StreamSink sink{os};
+    val.write(sink);
+    return os;
+}
+
+// Source of Env versions; every key insertion takes a fresh one, so a version is never reused
+// even by an Env allocated at a recycled address.
+unsigned long envEpoch = 0;
+
 // Environment class, which will function akin to a "stack" or symbol table where everything is kept.
 struct Env {
     std::shared_ptr<Env> outer;
-    std::unordered_map<string, Value> values;
+    Env* global; // root of the outer chain
+    unsigned long version = 0; // changes whenever a key is added, see set_value
+    std::unordered_map<string, Value, std::hash<string>, std::equal_to<string>, 
+                       TrackedAllocator<std::pair<const string, Value>, REnv>> values;
 
     Env(shared_ptr<Env> outer = nullptr) 
-        : outer(outer) {}
+        : outer(outer), global(outer ? outer->global : this) { stats.envAllocs++; }
 
     Value get_value(string s) const {
-        *varLog << "- reading symbol: " << s << " at " << this << std::endl;
-        if (auto it = values.find(s); it != values.end()) {
-            return Value(it->second);
-        } else if (outer) {
-            return Value(outer->get_value(s));
+        stats.envLookups++;
+        for(auto e = this; e; e = e->outer.get()) {
+            *varLog << "- reading symbol: " << s << " at " << e << std::endl;
+            if (auto it = e->values.find(s); it != e->values.end()) {
+                if(it->second.v.index() == 5)
+                    stats.listCopies++;
+                return Value(it->second);
+            }
+            stats.envHops++;
         }
         throw std::runtime_error("undefined symbol '" + string(s) + "'...");
     }
+    // Resolve a symbol to its storage so callers can update it in place.
+    Value& slot(const string& s) {
+        stats.envLookups++;
+        for(auto e = this; e; e = e->outer.get()) {
+            if (auto it = e->values.find(s); it != e->values.end())
+                return it->second;
+            stats.envHops++;
+        }
+        throw std::runtime_error("undefined symbol '" + s + "'...");
+    }
     void set_value(string s, const Value& val) { 
-        *traceLog << "(" << this << ") Assigning " << s << " = " << val.str() << std::endl;
-        *varLog << "(" << this << ") Assigning " << s << " = " << val.str() << std::endl;
-        values[s] = Value(val); 
+        *traceLog << "(" << this << ") Assigning " << s << " = " << val << std::endl;
+        *varLog << "(" << this << ") Assigning " << s << " = " << val << std::endl;
+        auto [it, inserted] = values.try_emplace(std::move(s));
+        it->second = val;
+        if(inserted) // map nodes never move, so cached slots only go stale when keys change
+            version = ++envEpoch;
     }
 };
 
+// Storage of a variable. A name never bound outside the global Env (see mark_global_names)
+// resolves there directly and is remembered in the node's inline cache, so steady-state
+// access is one compare and a load instead of a string lookup per scope.
+Value& name_slot(const Ast& name, Env& env) {
+    if(!name.global)
+        return env.slot(name.token_to_string());
+    auto& ic = name.cache;
+    Env* global = env.global;
+    if(ic.env == global && ic.version == global->version) {
+        stats.cacheHits++;
+        return *static_cast<Value*>(ic.slot);
+    }
+    Value& slot = global->slot(name.token_to_string());
+    ic = {global, &slot, global->version};
+    return slot;
+}
+
+// Names bound somewhere other than the global Env: parameters, assignments, loop and nested
+// function names inside function bodies, and comprehension variables anywhere.
+void collect_local_names(const shared_ptr<Ast>& node, bool inFunction, std::set<string>& out) {
+    switch(node->tag) {
+        case "function"_:
+            if(inFunction)
+                out.insert(node->nodes[0]->token_to_string());
+            for(size_t i = 1; i + 1 < node->nodes.size(); i++)
+                out.insert(node->nodes[i]->token_to_string());
+            inFunction = true;
+            break;
+        case "assignment"_: case "list_create"_: case "for"_:
+            if(inFunction)
+                out.insert(node->nodes[0]->token_to_string());
+            break;
+        case "list_comp"_:
+            out.insert(node->nodes[1]->token_to_string());
+            break;
+    }
+    for(auto& child : node->nodes)
+        collect_local_names(child, inFunction, out);
+}
+
+void mark_global_names(const shared_ptr<Ast>& node, const std::set<string>& locals) {
+    if(node->tag == "NAME"_)
+        node->global = !locals.count(node->token_to_string());
+    for(auto& child : node->nodes)
+        mark_global_names(child, locals);
+}
+
+shared_ptr<Env> make_env(shared_ptr<Env> outer = nullptr) {
+    return std::allocate_shared<Env>(TrackedAllocator<Env, REnv>(), std::move(outer));
+}
+
+// State captured by a user defined function; allocated through the tracked allocator so the
+// Function itself only holds a shared_ptr.
+struct Closure {
+    shared_ptr<Ast> decl;
+    shared_ptr<Env> env;
+    string name;
+};
+
 // Interpreter:
 Value eval(const shared_ptr<Ast>& ast, const shared_ptr<Env>& env);
 Value eval_call(const shared_ptr<Ast>& ast, const shared_ptr<Env>& env) {
-    auto fn = env->get_value(ast->nodes[0]->token_to_string()).get<Function>();
+    const auto& callee = name_slot(*ast->nodes[0], *env);
+    if(auto native = std::get_if<Native>(&callee.v)) { // Natives evaluate their own arguments.
+        ProfileScope frame(ast.get());
+        return (*native)(ast, env);
+    }
+    auto fn = callee.get<Function>();
     List values; 
     for(int i = 1u; i < ast->nodes.size(); i += 1) { // Push all the arguments for the call.
         values.push_back(eval(ast->nodes[i], env));
     }
+    ProfileScope frame(ast.get());
     return fn(values); // Call the function and return.
 }
 Value eval_assign(const shared_ptr<Ast>& ast, const shared_ptr<Env>& env) {
@@ -164,13 +543,14 @@ Value eval_assign(const shared_ptr<Ast>& ast, const shared_ptr<Env>& env) {
 }
 Value eval_block(const shared_ptr<Ast>& ast, const shared_ptr<Env>& env) {
     for(auto node : ast->nodes) {
+        if(profiler.enabled) profiler.statement(node.get());
         if(node->tag == "return_stmt"_) // encounter return in the block, no need to continue executing!
         {
             Value v(eval(node, env));
-            *traceLog << "returning " << Value::getTypeName(v.v.index()) << " " << v.str() << std::endl;
+            *traceLog << "returning " << Value::getTypeName(v.v.index()) << " " << v << std::endl;
             return v;
         }
-        else if(node->tag == "if"_) { // If return was called in a nested block, we need to check
+        else if(node->tag == "if"_ || node->tag == "for"_) { // If return was called in a nested block, we need to check
             Value v = eval(node, env);
             if(v.v.index() != 0)
                 return v;
@@ -180,102 +560,176 @@ Value eval_block(const shared_ptr<Ast>& ast, const shared_ptr<Env>& env) {
     }
     return Value();
 }
-Value eval_expr(const shared_ptr<Ast>& ast, const shared_ptr<Env>& env) {
+// Arithmetic operand; same TypeError as get<long>() without going through its catch path.
+long as_long(const Value& val) {
+    if(auto l = std::get_if<long>(&val.v))
+        return *l;
+    return val.get<long>();
+}
+List list_literal(const shared_ptr<Ast>& ast, const shared_ptr<Env>& env) {
+    List master;
+    for(auto k : ast->nodes) {
+        master.push_back(eval(k, env));
+    }
+    return master;
+}
+
+// The operand loops of the three expression forms, shared by the generic and specialized paths.
+Value concat_lists(List master, const shared_ptr<Ast>& ast, const shared_ptr<Env>& env) {
+    const auto& nodes = ast->nodes;
+    for(auto i = 2; i < nodes.size(); i += 2) {
+        if(nodes[i]->token[0] == '+') {
+            if(nodes[i+1]->tag == "raw_list"_) { // next term is raw_list
+                for(auto k : nodes[i+1]->nodes) {
+                    master.push_back(eval(k, env));
+                }
+            } else { // next term is list variable
+                auto l2 = eval(nodes[i+1], env);
+                for(auto& k : l2.ref<List>()) {
+                    if(k.v.index() != 0)
+                        master.push_back(k);
+                }
+            }
+        }
+    }
+    return Value(std::move(master));
+}
+Value concat_strings(string result, const shared_ptr<Ast>& ast, const shared_ptr<Env>& env) {
+    const auto& nodes = ast->nodes;
+    for(auto i = 2; i < nodes.size(); i += 2) {
+        if(nodes[i]->token[0] == '+') {
+            auto s2 = eval(nodes[i+1], env);
+            result += s2.ref<string>();
+        }
+    }
+    return Value(std::move(result));
+}
+// Variables the TypeChecker proved to hold ints are read straight from their slot.
+long int_operand(const shared_ptr<Ast>& node, const shared_ptr<Env>& env) {
+    if(node->type == TInt && node->tag == "NAME"_)
+        return std::get<long>(name_slot(*node, *env).v);
+    return as_long(eval(node, env));
+}
+Value int_arith(long first, const shared_ptr<Ast>& ast, const shared_ptr<Env>& env) {
+    const auto& nodes = ast->nodes;
+    long val = nodes[0]->token == "-" ? -first : first;
+    for(auto i = 2u; i < nodes.size(); i += 2) {
+        long rval = int_operand(nodes[i + 1], env);
+        switch(nodes[i]->token[0]) {
+            case '+':
+                val = val + rval;
+                break;
+            case '-':
+                val = val - rval;
+                break;
+        }
+    }
+    return Value(val);
+}
+
+Value eval_expr_generic(const shared_ptr<Ast>& ast, const shared_ptr<Env>& env) {
     // Expression can be in many defined forms. For operator overload we must check what context we are in by checking the AST tags.
+    // The form found on first execution is recorded so eval_expr can go straight to it next time.
     const auto& nodes = ast->nodes;
-    auto sign = nodes[0]->token_to_string();
+    bool unsigned_ = nodes[0]->token.empty();
+    auto learn = [&](Quick kind) {
+        if(ast->quick == QNone) {
+            ast->quick = kind;
+            stats.quickened++;
+        }
+    };
 
     if(nodes.size() == 2) { 
-        if(nodes[1]->tag == "call"_ || nodes[1]->tag == "list_value"_)
+        auto tag = nodes[1]->tag;
+        if((unsigned_ && (tag == "dict"_ || tag == "list_comp"_)) || tag == "call"_ || tag == "list_value"_ || tag == "STRING"_) {
+            learn(QExprValue);
             return eval(nodes[1], env);
-        else if(nodes[1]->tag == "STRING"_)
-            return Value(nodes[1]->token_to_string());
+        }
     }
     
     // Evaluate overloaded concatenation list expression starting with [] list
     if(nodes[1]->tag == "raw_list"_) {
-        List master;
-        for(auto k : ast->nodes[1]->nodes) {
-            master.push_back(eval(k, env));
-        }
-        for(auto i = 2; i < nodes.size(); i += 2) {
-            if(ast->nodes[i]->token_to_string()[0] == '+') {
-                if(ast->nodes[i+1]->tag == "raw_list"_) {
-                    for(auto k : ast->nodes[i+1]->nodes) {
-                        master.push_back(eval(k, env));
-                    }
-                }
-                else {
-                    List l2 = env->get_value(ast->nodes[i+1]->token_to_string()).get<List>();
-                    for(auto k : l2) {
-                        if(k.v.index() != 0)
-                            master.push_back(k);
-                    }
-                }
-            }
-        }
-
-        return Value(master);
+        learn(QExprRawList);
+        return concat_lists(list_literal(nodes[1], env), ast, env);
     } 
     else if(nodes[1]->tag == "NAME"_) {
-        auto val = env->get_value(nodes[1]->token_to_string());
+        auto val = nodes[1]->global ? Value(name_slot(*nodes[1], *env)) : env->get_value(nodes[1]->token_to_string());
+        if(nodes.size() == 2 && unsigned_) { // plain variable read, any type
+            learn(QExprValue);
+            return val;
+        }
         if(val.v.index() == 5) { // List expression starting with a variable
-            List master = val.get<List>();
-            for(auto i = 2; i < nodes.size(); i += 2) {
-                if(ast->nodes[i]->token_to_string()[0] == '+') {
-                    if(ast->nodes[i+1]->tag == "raw_list"_) { // next term is raw_list
-                        for(auto k : ast->nodes[i+1]->nodes) {
-                            master.push_back(eval(k, env));
-                        }
-                    } else { // next term is list variable
-                        List l2 = env->get_value(ast->nodes[i+1]->token_to_string()).get<List>();
-
-                        for(auto k : l2) {
-                            if(k.v.index() != 0)
-                                master.push_back(k);
-                        }
-                    }
-                }
-            }
-            return Value(master);
+            learn(QExprList);
+            return concat_lists(std::move(val.ref<List>()), ast, env);
         }
         else if (val.v.index() == 3) // string concat
         {
-            string result = val.get<string>();
-            for(auto i = 2; i < nodes.size(); i += 2) {
-                if(ast->nodes[i]->token_to_string()[0] == '+') {
-                    auto s2 = eval(ast->nodes[i+1], env);
-                    result = result + s2.get<string>();
-                }
-            }
-            return Value(result);
+            learn(QExprString);
+            val.account(false); // the buffer leaves the Value; the result accounts for it again
+            return concat_strings(std::move(val.ref<string>()), ast, env);
         }
+        learn(QExprInt);
+        return int_arith(as_long(val), ast, env);
     } 
 
     // Regular arithmetic expression.
-    long sign_val = (sign.empty() || sign == "+") ? 1 : -1;
-    long val = eval(nodes[1], env).get<long>() * sign_val;
-    for(auto i = 2u; i < nodes.size(); i += 2) {
-        auto oper = nodes[i + 0]->token_to_string()[0];
-        long rval = eval(nodes[i + 1], env).get<long>();
-        switch(oper) {
-            case '+':
-                val = val + rval;
-                break;
-            case '-':
-                val = val - rval;
-                break;
+    learn(QExprInt);
+    return int_arith(as_long(eval(nodes[1], env)), ast, env);
+}
+
+// A specialization's guard failed: the node goes back to the generic path for good.
+Value deoptimize(const shared_ptr<Ast>& ast, const shared_ptr<Env>& env) {
+    ast->quick = QGeneric;
+    stats.deopts++;
+    return eval_expr_generic(ast, env);
+}
+
+Value eval_expr(const shared_ptr<Ast>& ast, const shared_ptr<Env>& env) {
+    const auto& nodes = ast->nodes;
+    // Only a leading variable can change type between runs; every other form is fixed by the
+    // syntax, so only those paths carry a guard. Nodes the TypeChecker specialized (`typed`)
+    // can't fail it and skip straight to the operation.
+    switch(ast->quick) {
+        case QExprValue:
+            return eval(nodes[1], env);
+        case QExprRawList:
+            return concat_lists(list_literal(nodes[1], env), ast, env);
+        case QExprInt: {
+            if(nodes[1]->tag != "NAME"_)
+                return int_arith(int_operand(nodes[1], env), ast, env);
+            const auto& first = name_slot(*nodes[1], *env);
+            if(ast->typed)
+                return int_arith(std::get<long>(first.v), ast, env);
+            if(auto l = std::get_if<long>(&first.v))
+                return int_arith(*l, ast, env);
+            return deoptimize(ast, env);
+        }
+        case QExprString: {
+            const auto& first = name_slot(*nodes[1], *env);
+            if(ast->typed)
+                return concat_strings(std::get<string>(first.v), ast, env);
+            if(auto str = std::get_if<string>(&first.v))
+                return concat_strings(*str, ast, env);
+            return deoptimize(ast, env);
         }
+        case QExprList: {
+            const auto& first = name_slot(*nodes[1], *env);
+            if(ast->typed)
+                return concat_lists(std::get<List>(first.v), ast, env);
+            if(auto list = std::get_if<List>(&first.v))
+                return concat_lists(*list, ast, env);
+            return deoptimize(ast, env);
+        }
+        default:
+            return eval_expr_generic(ast, env);
     }
-
-    return Value(val);
 }
 Value eval_term(const shared_ptr<Ast>& ast, const shared_ptr<Env>& env) { // Evaluate term
     const auto& nodes = ast->nodes;
-    long val = eval(nodes[0], env).get<long>();
+    long val = int_operand(nodes[0], env);
     for(auto i = 1u; i < nodes.size(); i += 2) {
-        auto oper = nodes[i + 0]->token_to_string()[0];
-        long rval = eval(nodes[i + 1], env).get<long>();
+        auto oper = nodes[i + 0]->token[0];
+        long rval = int_operand(nodes[i + 1], env);
         switch(oper) {
             case '*':
                 val = val * rval;
@@ -289,26 +743,57 @@ Value eval_term(const shared_ptr<Ast>& ast, const shared_ptr<Env>& env) { // Eva
     }
     return Value(val);
 }
-Value declare_function(const shared_ptr<Ast>& ast, const shared_ptr<Env>& env) {
-    string name = ast->nodes[0]->token_to_string();
+// Callable behind a user defined function's Value. Named, rather than a lambda, so the
+// embedding API can get at the Closure and run a batch of calls in one frame.
+// Parses a def body that was only skimmed at load time into a lazy_block (see --lazy); set by
+// whoever owns the parser. Throws on a syntax error.
+std::function<shared_ptr<Ast>(const Ast& lazy)> parseLazyBody;
 
-    // Setup function with values that are passed to it. The actual evaluation will happen in the function block with the parameters set here.
-    auto fxn = Value(Function([=](const List& values) {
-    
-        shared_ptr<Env> context = std::make_shared<Env>(env); // Setup function's own symbol table
+// Body of a user function. A skimmed one is parsed on the first call and replaces its
+// lazy_block, so later calls find the block directly.
+const shared_ptr<Ast>& function_block(const shared_ptr<Ast>& decl) {
+    auto& block = decl->nodes.back();
+    if(block->tag == "lazy_block"_) {
+        auto parsed = parseLazyBody(*block);
+        parsed->parent = decl;
+        block = parsed;
+        std::set<string> locals; // only the function itself can bind names its body reads locally
+        collect_local_names(decl, false, locals);
+        mark_global_names(block, locals);
+        stats.lazyParsed++;
+    }
+    return block;
+}
+
+struct UserFunction {
+    shared_ptr<Closure> closure;
+
+    // Bind the arguments in `context` and execute the body there.
+    Value run(const List& values, const shared_ptr<Env>& context) const {
+        auto& ast = closure->decl;
+        auto& name = closure->name;
         for(auto i = 0; i < values.size(); i ++) { // Assign function call values passed as a vector.
             auto str = ast->nodes[1+i]->token_to_string();
-            *traceLog << "- assign fxn " << name << " value " << str << " to: " << values[i].str() << std::endl;
+            *traceLog << "- assign fxn " << name << " value " << str << " to: " << values[i] << std::endl;
             context->set_value(str, Value(values[i])); // assign them to our defined symbol table
         }
         *traceLog << "-- executing " << name << "  ---" << std::endl;
-        auto block = ast->nodes.back(); // get block address
+        auto& block = function_block(ast);
         auto v = eval(block, context); // execute the function value
         *traceLog << "-- end func " << name << ", rtn: " << Value::getTypeName(v.v.index()) << std::endl;
         return v;
-    }));
+    }
+    Value operator()(const List& values) const {
+        return run(values, make_env(closure->env)); // Setup function's own symbol table
+    }
+};
+
+Value declare_function(const shared_ptr<Ast>& ast, const shared_ptr<Env>& env) {
+    string name = ast->nodes[0]->token_to_string();
 
-    env->set_value(name, fxn);
+    // Setup function with values that are passed to it. The actual evaluation will happen in the function block with the parameters set here.
+    auto closure = std::allocate_shared<Closure>(TrackedAllocator<Closure, RClosure>(), Closure{ast, env, name});
+    env->set_value(name, Value(Function(UserFunction{closure})));
     return Value();
 }
 
@@ -331,9 +816,19 @@ Value declare_list(const shared_ptr<Ast>& ast, const shared_ptr<Env>& env) {
 
     return Value();
 }
+Value eval_raw_list(const shared_ptr<Ast>& ast, const shared_ptr<Env>& env) { // [a, b, ...] used as a value
+    return Value(list_literal(ast, env));
+}
+Value eval_dict(const shared_ptr<Ast>& ast, const shared_ptr<Env>& env) { // {k: v, ...}
+    Dict dict;
+    for(auto& item : ast->nodes) {
+        auto key = eval(item->nodes[0], env);
+        dict[key] = eval(item->nodes[1], env);
+    }
+    return Value(std::move(dict));
+}
 Value access_list(const shared_ptr<Ast>& ast, const shared_ptr<Env>& env) {
     string name = ast->nodes[0]->token_to_string();
-    auto vList = env->get_value(name).get<List>();
     // Accessing a spliced list
     if(ast->nodes[1]->tag == "list_splice"_) {
         auto& iNodes = ast->nodes[1]->nodes;
@@ -345,6 +840,7 @@ Value access_list(const shared_ptr<Ast>& ast, const shared_ptr<Env>& env) {
             else if(k->tag == "rightSp"_)
                 r = eval(k, env).get<long>();
         }
+        const auto& vList = name_slot(*ast->nodes[0], *env).ref<List>();
         if(l != -1 && r == -1) { // list[x:]
             r = vList.size();
         } else if(l == -1 && r != -1) { // list[:x]
@@ -362,7 +858,23 @@ Value access_list(const shared_ptr<Ast>& ast, const shared_ptr<Env>& env) {
         return Value(t);
     }
     else { // Non splice list.
-        auto index = eval(ast->nodes[1], env).get<long>();
+        auto key = eval(ast->nodes[1], env);
+        const auto& target = name_slot(*ast->nodes[0], *env);
+        if(auto r = std::get_if<Range>(&target.v)) {
+            auto index = key.get<long>();
+            if(index < 0 || index >= (long) r->size())
+                throw std::runtime_error("Accessing invalid element");
+            return Value(r->at(index));
+        }
+        if(auto dict = std::get_if<Dict>(&target.v)) {
+            *traceLog << "Get dict value from " << name  << " at " << key << std::endl;
+            auto found = dict->find(key);
+            if(!found)
+                throw std::runtime_error("KeyError: " + key.str());
+            return *found;
+        }
+        const auto& vList = target.ref<List>();
+        auto index = key.get<long>();
         *traceLog << "Get list value from " << name  << " at " << index << std::endl;
         
         if(index < 0 || index >= vList.size())
@@ -372,9 +884,9 @@ Value access_list(const shared_ptr<Ast>& ast, const shared_ptr<Env>& env) {
     }
 }
 
+// Updates the stored list or dict in place rather than copying it out and back.
 Value list_assign(const shared_ptr<Ast>& ast, const shared_ptr<Env>& env) {
     string name = ast->nodes[0]->token_to_string();
-    auto v = env->get_value(name).get<List>();
     
     if(ast->nodes[1]->tag == "list_splice"_) { // 
         auto& iNodes = ast->nodes[1]->nodes;
@@ -386,6 +898,8 @@ Value list_assign(const shared_ptr<Ast>& ast, const shared_ptr<Env>& env) {
             else if(k->tag == "rightSp"_)
                 r = eval(k, env).get<long>();
         }
+        auto fromList = eval(ast->nodes[2], env).get<List>();
+        auto& v = name_slot(*ast->nodes[0], *env).ref<List>();
         if(l != -1 && r == -1) { // list[x:]
             r = v.size();
         } else if(l == -1 && r != -1) { // list[:x]
@@ -396,154 +910,182 @@ Value list_assign(const shared_ptr<Ast>& ast, const shared_ptr<Env>& env) {
             l = 0;
             r = v.size();
         }  
-        auto fromList = eval(ast->nodes[2], env).get<List>();
         for(int i = l, j = 0; i < r; i ++, j++) {
             v[i] = fromList[j];
         }
+        *traceLog << "(" << env.get() << ") Assigning " << name << "[" << l << ":" << r << "]" << std::endl;
     }
     else { // normal index assign
+        auto key = eval(ast->nodes[1], env);
+        auto value = eval(ast->nodes[2], env);
+        auto& target = name_slot(*ast->nodes[0], *env);
+        *traceLog << "(" << env.get() << ") Assigning " << name << "[" << key << "] = " << value << std::endl;
+        if(auto dict = std::get_if<Dict>(&target.v)) {
+            (*dict)[key] = std::move(value);
+            return Value();
+        }
+        auto& v = target.ref<List>();
         int upper = 0;
         for(int i = 0; i < v.size(); i ++)
             if(v[i].v.index() != 0) upper++;
-        auto index = eval(ast->nodes[1], env).get<long>();
+        auto index = key.get<long>();
         if(index < 0 || index >= upper) throw std::runtime_error("IndexError: list assignment index out of range");
 
-        v[index] = eval(ast->nodes[2], env);
+        v[index] = std::move(value);
     }
-    env->set_value(name, Value(v));
 
     return Value();
 }
 
+// Python truthiness; a list's nil placeholders don't count as items.
+bool truthy(const Value& val) {
+    switch (val.v.index()) {
+        case 0: return false;
+        case 1: return std::get<bool>(val.v);
+        case 2: return std::get<long>(val.v) != 0;
+        case 3: return !std::get<string>(val.v).empty();
+        case 5:
+            for(auto& item : std::get<List>(val.v))
+                if(item.v.index() != 0) return true;
+            return false;
+        case 7: return std::get<Dict>(val.v).size() != 0;
+        case 8: return std::get<Range>(val.v).size() != 0;
+    }
+    return true;
+}
+
+// The condition of an if, while or comprehension filter: either `not VALUE` or
+// `VALUE op VALUE`, where ordering works on two ints or two strings.
+bool eval_compare(const shared_ptr<Ast>& compare, const shared_ptr<Env>& env) {
+    auto& nodes = compare->nodes;
+    if(nodes.size() == 2)
+        return !truthy(eval(nodes[1], env));
+    auto lhs = eval(nodes[0], env);
+    auto oper = peg::str2tag(nodes[1]->token_to_string());
+    if(oper == "and"_)
+        return truthy(lhs) && truthy(eval(nodes[2], env));
+    if(oper == "or"_)
+        return truthy(lhs) || truthy(eval(nodes[2], env));
+    auto rhs = eval(nodes[2], env);
+    if(oper == "=="_)
+        return same_value(lhs, rhs);
+    if(oper == "!="_)
+        return !same_value(lhs, rhs);
+    int order = lhs.v.index() == 3 ? lhs.ref<string>().compare(rhs.ref<string>()) 
+                                   : (lhs.get<long>() > rhs.get<long>()) - (lhs.get<long>() < rhs.get<long>());
+    switch(oper) {
+        case "<"_: return order < 0;
+        case "<="_: return order <= 0;
+        case ">"_: return order > 0;
+        case ">="_: return order >= 0;
+    }
+    throw std::runtime_error("Invalid comparator");
+}
+
 Value eval_while(const shared_ptr<Ast>& ast, const shared_ptr<Env>& env) {
     *traceLog << "---- starting while loop" << std::endl;
-    auto ifNode = ast->nodes[0]->nodes;
-    auto oper = peg::str2tag(ifNode[1]->token_to_string());
+    auto& condition = ast->nodes[0];
+    auto& block = ast->nodes[1];
 
-    auto block = ast->nodes[1];
-
-    bool done = false;
     unsigned int loopct = 0;
-
-    while(done == false) 
+    while(eval_compare(condition, env)) 
     {
-        long lhs = eval(ifNode[0], env).get<long>();
-        long rhs = eval(ifNode[2], env).get<long>();
         *traceLog << "loop " << loopct << std::endl;
-        switch(oper) 
-        {
-            case "=="_: 
-                if(lhs == rhs) {
-                    eval(block, env);
-                } else {
-                    done = true;
-                }
-                break;
-            case "<"_:
-                if(lhs < rhs) {
-                    eval(block, env);
-                } else {
-                    done = true;
-                }
-                break;
-            case "<="_:
-                if(lhs <= rhs) {
-                    eval(block, env);
-                } else {
-                    done = true;
-                }
-                break;
-            case ">"_:
-                if(lhs > rhs) {
-                    eval(block, env);
-                } else {
-                    done = true;
-                }
-                break;
-            case ">="_:
-                if(lhs >= rhs) {
-                    eval(block, env);
-                } else {
-                    done = true;
-                }
-                break;
-            case "!="_: 
-                if(lhs != rhs) {
-                    eval(block, env);
-                } else {
-                    done = true;
-                }
-                break;
-            default:
-                std::runtime_error("Invalid if comparator");
-                break;
-        }
+        eval(block, env);
         loopct++;
     }
     *traceLog << "---- end while loop" << std::endl;
     return Value();
 }
 
-Value eval_if(const shared_ptr<Ast>& ast, const shared_ptr<Env>& env) {
-    auto& ifNode = ast->nodes[0]->nodes;
-
-    // evaluate condition
-    long lhs = eval(ifNode[0], env).get<long>();
-    auto oper = peg::str2tag(ifNode[1]->token_to_string());
-    long rhs = eval(ifNode[2], env).get<long>();
-
+// The variable behind a sign-less single-term expression, e.g. the `l` in `for x in l:`.
+const Ast* plain_name(const shared_ptr<Ast>& node) {
+    if(node->tag == "NAME"_)
+        return node.get();
+    if(node->tag == "expression"_ && node->nodes.size() == 2 && node->nodes[0]->token.empty() && node->nodes[1]->tag == "NAME"_)
+        return node->nodes[1].get();
+    return nullptr;
+}
 
-    switch(oper) {
-        case "=="_: 
-            if(lhs == rhs) {
-                return eval(ast->nodes[1], env);
-            } else if(ast->nodes.size() > 2) {
-                return eval(ast->nodes[2], env);
-            }
-            break;
-        case "<"_:
-            if(lhs < rhs) {
-                return eval(ast->nodes[1], env);
-            } else if(ast->nodes.size() > 2) {
-                return eval(ast->nodes[2], env);
-            }
-            break;
-        case "<="_:
-            if(lhs <= rhs) {
-                return eval(ast->nodes[1], env);
-            } else if(ast->nodes.size() > 2) {
-                return eval(ast->nodes[2], env);
-            }
-            break;
-        case ">"_:
-            if(lhs > rhs) {
-                return eval(ast->nodes[1], env);
-            } else if(ast->nodes.size() > 2) {
-                return eval(ast->nodes[2], env);
-            }
-            break;
-        case ">="_:
-            if(lhs >= rhs) {
-                return eval(ast->nodes[1], env);
-            } else if(ast->nodes.size() > 2) {
-                return eval(ast->nodes[2], env);
-            }
-            break;
-        case "!="_:
-            if(lhs != rhs) {
-                return eval(ast->nodes[1], env);
-            } else if(ast->nodes.size() > 2) {
-                return eval(ast->nodes[2], env);
+// Runs f over the items of the iterable expression. A plain list variable is walked in its
+// storage rather than copied, re-fetched each step so f may append to it; anything else is
+// evaluated once and handed to for_each_item, which keeps ranges lazy. sizeHint, when given,
+// receives the item count if it is known up front.
+template<typename F>
+void for_each_in(const shared_ptr<Ast>& iterable, const shared_ptr<Env>& env, F&& f, size_t* sizeHint = nullptr) {
+    if(auto var = plain_name(iterable)) {
+        Value* slot = &name_slot(*var, *env);
+        if(slot->v.index() == 5) {
+            if(sizeHint) *sizeHint = std::get<List>(slot->v).size();
+            for(size_t i = 0;; i++) {
+                auto list = std::get_if<List>(&slot->v);
+                if(!list || i >= list->size())
+                    break;
+                if((*list)[i].v.index() != 0 && !f((*list)[i]))
+                    break;
             }
-            break;
-        default:
-            std::runtime_error("Invalid if comparator");
+            return;
+        }
+    }
+    auto seq = eval(iterable, env);
+    if(sizeHint) {
+        if(auto list = std::get_if<List>(&seq.v)) *sizeHint = list->size();
+        else if(auto r = std::get_if<Range>(&seq.v)) *sizeHint = r->size();
+        else if(auto dict = std::get_if<Dict>(&seq.v)) *sizeHint = dict->size();
     }
+    for_each_item(seq, f);
+}
+
+Value eval_for(const shared_ptr<Ast>& ast, const shared_ptr<Env>& env) {
+    auto name = ast->nodes[0]->token_to_string();
+    auto& block = ast->nodes[2];
+    *traceLog << "---- starting for loop over " << name << std::endl;
+
+    Value result;
+    for_each_in(ast->nodes[1], env, [&](const Value& item) {
+        env->set_value(name, item);
+        result = eval(block, env);
+        return result.v.index() == 0; // a return inside the body ends the loop
+    });
+    *traceLog << "---- end for loop" << std::endl;
+    return result;
+}
+
+// [element for name in iterable if condition]: one native loop into a preallocated list. The
+// loop variable lives in a single scope for the whole comprehension and is assigned through its
+// slot, so no Env is created or searched per element.
+Value eval_list_comp(const shared_ptr<Ast>& ast, const shared_ptr<Env>& env) {
+    auto& element = ast->nodes[0];
+    auto name = ast->nodes[1]->token_to_string();
+    shared_ptr<Ast> condition = ast->nodes.size() > 3 ? ast->nodes[3] : nullptr;
+
+    auto scope = make_env(env);
+    Value& var = scope->values[name];
+    List out;
+    size_t size = 0;
+    for_each_in(ast->nodes[2], env, [&](const Value& item) {
+        if(out.capacity() == 0 && size && !condition)
+            out.reserve(size);
+        var = item;
+        if(!condition || eval_compare(condition, scope))
+            out.push_back(eval(element, scope));
+        return true;
+    }, &size);
+    return Value(std::move(out));
+}
+
+Value eval_if(const shared_ptr<Ast>& ast, const shared_ptr<Env>& env) {
+    if(eval_compare(ast->nodes[0], env))
+        return eval(ast->nodes[1], env);
+    if(ast->nodes.size() > 2)
+        return eval(ast->nodes[2], env);
     return Value();
 }
 
 Value eval(const shared_ptr<Ast>& ast, const shared_ptr<Env>& env) {
     *traceLog << ast->name << std::endl;
+    NodeTimer timer(ast.get());
+    resources.tick();
 
     // Switch to eval proper token type
     switch (ast->tag) {
@@ -560,11 +1102,17 @@ Value eval(const shared_ptr<Ast>& ast, const shared_ptr<Env>& env) {
 
 
         case "NAME"_:
+            if(ast->global)
+                return name_slot(*ast, *env);
             return env->get_value(ast->token_to_string());
         case "STRING"_:
             return Value(ast->token_to_string());
         case "NUMBER"_:
-            return Value(ast->token_to_number<long>());
+            if(ast->quick != QNumber) { // parse the literal once
+                ast->constant = ast->token_to_number<long>();
+                ast->quick = QNumber;
+            }
+            return Value(ast->constant);
 
 
         case "function"_:
@@ -584,6 +1132,12 @@ Value eval(const shared_ptr<Ast>& ast, const shared_ptr<Env>& env) {
             return declare_list(ast, env);
         case "list_value"_:
             return access_list(ast, env);
+        case "raw_list"_:
+            return eval_raw_list(ast, env);
+        case "dict"_:
+            return eval_dict(ast, env);
+        case "list_comp"_:
+            return eval_list_comp(ast, env);
         // case "list_splice"_:
         //     return splice_list(ast, env);
 
@@ -592,6 +1146,8 @@ Value eval(const shared_ptr<Ast>& ast, const shared_ptr<Env>& env) {
 
         case "while"_:
             return eval_while(ast, env);
+        case "for"_:
+            return eval_for(ast, env);
 
         default:
             if(ast->nodes.size()) return eval(ast->nodes[0], env);
@@ -599,30 +1155,86 @@ Value eval(const shared_ptr<Ast>& ast, const shared_ptr<Env>& env) {
     return Value();
 }
 
-void interpret(shared_ptr<Ast> ast, std::ostream& os, std::ostream& trace, std::ostream& var, std::ostream& error) {
-    auto global = std::make_shared<Env>();
-    traceLog = &trace;
-    varLog = &var;
-    errorLog = &error;
-
-    // Setup print function manually.
-    global->set_value("print", Value(Function([&](const List& values) {
-        *traceLog << "print called" << std::endl; 
-        int count = 0;
-        for(auto& v : values) {
-            if(count++ > 0)
-                os << " " << v.str();
-            else
-                os << v.str();
-        }
-        os << std::endl;
-        return Value();
-    })));
-
-    // Setup len function. 
-    global->set_value("len", Value(Function([&](const List& values) {
-        assert(values.size() == 1); // make sure only 1 argument.
-        return Value((long) values.back().get<List>().size()); // expected argument is list. so just check the container value otherwise typeerror is thrown automatically.
-    })));
-    eval(ast, global);
-}
\ No newline at end of file
+// Typed host function binding and the native builtin library (append, range, sorted, ...);
+// both build on the evaluator above.
+#include "Binding.hpp"
+#include "Builtins.hpp"
+
+// Owns the global Env with the builtins registered and the buffer print() writes to.
+struct Interpreter {
+    shared_ptr<Env> global;
+    OutputBuffer out;
+
+    Interpreter(std::ostream& os, std::ostream& trace, std::ostream& var, std::ostream& error,
+                FlushPolicy flush = FlushPolicy::Line)
+        : out(os, flush) {
+        resources.reset();
+        traceLog = &trace;
+        varLog = &var;
+        errorLog = &error;
+        global = make_env();
+
+        // print(...) is variadic, so it evaluates and writes its arguments one at a time itself.
+        global->set_value("print", Value(Native([this](const shared_ptr<Ast>& call, const shared_ptr<Env>& env) {
+            *traceLog << "print called" << std::endl; 
+            for(size_t i = 1; i < call->nodes.size(); i++) {
+                if(i > 1)
+                    out.put(' ');
+                eval(call->nodes[i], env).write(out);
+            }
+            out.end_line();
+            return Value();
+        })));
+
+        // Pushes buffered print output to the stream; needed under the explicit flush policy.
+        def("flush", [this]() { out.flush(); });
+
+        // Marks the end of a script's setup; saves the globals under --snapshot, see Snapshot.hpp.
+        def("snapshot", []() {});
+
+        def("len", [](const Value& v) -> long {
+            if(auto str = std::get_if<string>(&v.v))
+                return str->size();
+            if(auto dict = std::get_if<Dict>(&v.v))
+                return dict->size();
+            if(auto r = std::get_if<Range>(&v.v))
+                return r->size();
+            return v.ref<List>().size(); // anything else must be a list; ref throws the TypeError
+        });
+
+        register_builtins(global);
+    }
+    Interpreter(const Interpreter&) = delete;
+
+    // Registers a host function; see Binding.hpp for the supported parameter types.
+    template<typename F>
+    void def(const string& name, F f) {
+        ::def(global, name, std::move(f));
+    }
+
+    Value run(const shared_ptr<Ast>& ast) {
+        std::set<string> locals;
+        collect_local_names(ast, false, locals);
+        mark_global_names(ast, locals);
+        return eval(ast, global);
+    }
+
+    // Runs one top-level item of a program that is parsed piece by piece. Only its own bindings
+    // can shadow a global for its names, since functions close over the Env they're defined
+    // in. False once a top-level `return` inside an if or for has ended the program, as
+    // eval_block would.
+    bool run_item(const shared_ptr<Ast>& item) {
+        std::set<string> locals;
+        collect_local_names(item, false, locals);
+        mark_global_names(item, locals);
+        if(profiler.enabled) profiler.statement(item.get());
+        Value v = eval(item, global);
+        return !((item->tag == "if"_ || item->tag == "for"_) && v.v.index() != 0);
+    }
+};
+
+void interpret(shared_ptr<Ast> ast, std::ostream& os, std::ostream& trace, std::ostream& var, std::ostream& error, 
+               FlushPolicy flush = FlushPolicy::Line) {
+    Interpreter interp(os, trace, var, error, flush);
+    interp.run(ast);
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read-only memory mapping of a whole file. Move-only; the mapping lives as long as the object,
+// so string_views into data() stay valid until then.
+struct MappedFile {
+    const char* ptr = nullptr;
+    size_t len = 0;
+
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& rhs) noexcept
+        : ptr(std::exchange(rhs.ptr, nullptr)), len(std::exchange(rhs.len, 0)) {}
+    MappedFile& operator=(MappedFile&& rhs) noexcept {
+        if(this != &rhs) {
+            close();
+            ptr = std::exchange(rhs.ptr, nullptr);
+            len = std::exchange(rhs.len, 0);
+        }
+        return *this;
+    }
+    ~MappedFile() { close(); }
+
+    // False if the file can't be opened or mapped. An empty file maps to an empty range.
+    bool open(const std::string& path) {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0)
+            return false;
+        struct stat st;
+        bool ok = fstat(fd, &st) == 0;
+        if(ok && st.st_size > 0) {
+            void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            ok = p != MAP_FAILED;
+            if(ok) {
+                ptr = static_cast<const char*>(p);
+                len = st.st_size;
+            }
+        }
+        ::close(fd); // the mapping keeps its own reference
+        return ok;
+    }
+    void close() {
+        if(ptr)
+            munmap(const_cast<char*>(ptr), len);
+        ptr = nullptr;
+        len = 0;
+    }
+
+    // Hands the whole pages inside [begin, end) back to the kernel, so a long sequential scan
+    // doesn't keep the file resident; touching them again reads them back in.
+    void release(size_t begin, size_t end) const {
+        size_t page = sysconf(_SC_PAGESIZE);
+        begin = (begin + page - 1) / page * page;
+        end = end / page * page;
+        if(ptr && begin < end)
+            madvise(const_cast<char*>(ptr) + begin, end - begin, MADV_DONTNEED);
+    }
+
+    const char* data() const { return ptr ? ptr : ""; }
+    size_t size() const { return len; }
+    std::string_view view() const { return {data(), len}; }
+};
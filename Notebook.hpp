@@ -0,0 +1,269 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <ostream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "Include/peglib.h"
+#include "Interpreter.hpp"
+#include "Grammar.hpp"
+#include "AstCache.hpp"
+#include "Reparse.hpp"
+
+// Notebook-style reruns: a session is handed the whole script again after each tweak and only
+// re-executes the top-level items that could come out differently. Every item is recorded with
+// a structural hash of its AST, the globals it may read and write, and copies of the globals
+// it wrote as they were right after it ran. On the next run an item whose hash is unchanged and
+// none of whose names were touched by an edited or re-executed item before it is skipped: its
+// recorded values are copied back into the fresh global Env instead. Everything else runs, and
+// what it writes counts as touched for the items after it.
+//
+// The read and write sets are static and err on the side of too many names: every NAME is a
+// read, and a call brings in everything the called def's body (and what that calls) reads and
+// writes. The fallbacks are conservative:
+//  - an item that reaches print() or another builtin with effects outside the interpreter
+//    always runs, and its writes count as touched;
+//  - an item calling something that isn't a def or builtin by name always runs, and touches
+//    every name after it;
+//  - an item whose values hold a function is never skipped, since functions belong to the run
+//    that made them;
+//  - defs are always declared again, which costs nothing, but only touch their name when
+//    their text changed.
+// Assignments inside a def body bind locals, so they aren't writes.
+
+// Builtins that act outside the interpreter's state, or read from outside it.
+const std::set<string> effectful_builtins = {"print", "flush", "snapshot", "open_lines", "read_ints", "write_lines"};
+// Builtins that change the list variable named by their first argument.
+const std::set<string> mutating_builtins = {"append", "pop", "extend", "insert"};
+
+struct Effects {
+    std::set<string> reads, writes, calls;
+    bool external = false; // reaches an effectful builtin
+    bool opaque = false;   // calls something that can't be followed
+};
+
+// Names a subtree may read, write and call; `inFunction` from inside a def body on.
+void collect_effects(const shared_ptr<Ast>& node, bool inFunction, Effects& e) {
+    switch(node->tag) {
+        case "NAME"_:
+            e.reads.insert(node->token_to_string());
+            break;
+        case "function"_:
+            if(!inFunction)
+                e.writes.insert(node->nodes[0]->token_to_string());
+            inFunction = true;
+            break;
+        case "assignment"_: case "list_create"_: case "for"_:
+            if(!inFunction)
+                e.writes.insert(node->nodes[0]->token_to_string());
+            break;
+        case "list_assign"_:
+            e.writes.insert(node->nodes[0]->token_to_string());
+            break;
+        case "call"_: {
+            auto callee = node->nodes[0]->token_to_string();
+            e.calls.insert(callee);
+            if(mutating_builtins.count(callee) && node->nodes.size() > 1 && node->nodes[1]->tag == "NAME"_)
+                e.writes.insert(node->nodes[1]->token_to_string());
+            break;
+        }
+    }
+    for(auto& child : node->nodes)
+        collect_effects(child, inFunction, e);
+}
+
+// Hash of the tree's shape, rule names and tokens; positions and line numbers don't count, so
+// moving a statement around or editing above it keeps its hash.
+uint64_t ast_hash(const Ast& node, uint64_t h = ast_cache::fnv1a("")) {
+    h = ast_cache::fnv1a(node.name, h);
+    if(node.is_token)
+        return ast_cache::fnv1a(std::string_view("\0", 1), ast_cache::fnv1a(node.token, h));
+    h = ast_cache::fnv1a("(", h);
+    for(auto& child : node.nodes)
+        h = ast_hash(*child, h);
+    return ast_cache::fnv1a(")", h);
+}
+
+// Whether a value carries a function, which can't outlive the Env it was made in.
+bool holds_code(const Value& v) {
+    if(v.v.index() == 4 || v.v.index() == 6)
+        return true;
+    if(auto list = std::get_if<List>(&v.v)) {
+        for(auto& item : *list)
+            if(holds_code(item))
+                return true;
+    } else if(auto dict = std::get_if<Dict>(&v.v)) {
+        for(auto& item : dict->values)
+            if(holds_code(item))
+                return true;
+    }
+    return false;
+}
+
+struct Notebook {
+    struct Record {
+        uint64_t hash;
+        Effects effects;
+        bool cached = false;          // `after` can stand in for running the item
+        std::map<string, Value> after; // its writes that were bound once it ran
+    };
+
+    peg::parser parser;
+    string errors; // syntax errors of the last run
+    std::unique_ptr<IncrementalParse> parse;
+    std::vector<Record> records; // per item of the last run, up to where it stopped
+    size_t executed = 0;         // items the last run executed
+    size_t skipped = 0;          // and restored instead
+
+    std::ostream& out;
+    std::ostream& trace;
+    std::ostream& var;
+    std::ostream& error;
+
+    Notebook(std::ostream& out, std::ostream& trace, std::ostream& var, std::ostream& error)
+        : parser(minipython_grammar), out(out), trace(trace), var(var), error(error) {
+        if(!parser)
+            throw std::runtime_error("minipython grammar failed to load");
+        parser.enable_ast<Ast>();
+        install_hooks(parser);
+        parser.set_logger([this](size_t line, size_t col, const string& msg, const string&) {
+            errors += std::to_string(line) + ":" + std::to_string(col) + ": " + msg + "\n";
+        });
+    }
+    Notebook(const Notebook&) = delete;
+
+    // Runs the script's new text; false on a syntax error, which runs nothing. Errors the
+    // script raises are thrown after the items before the failing one have been recorded.
+    bool run(const string& source) {
+        errors.clear();
+        if(!parse) {
+            parse = std::make_unique<IncrementalParse>(parser, source);
+        } else {
+            // One edit covering everything between the common prefix and suffix.
+            auto& old = *parse->text;
+            size_t prefix = 0, suffix = 0;
+            while(prefix < old.size() && prefix < source.size() && old[prefix] == source[prefix])
+                prefix++;
+            while(suffix < old.size() - prefix && suffix < source.size() - prefix
+                  && old[old.size() - 1 - suffix] == source[source.size() - 1 - suffix])
+                suffix++;
+            parse->edit({{prefix, old.size() - prefix - suffix, source.substr(prefix, source.size() - prefix - suffix)}});
+        }
+        if(!parse->ast)
+            return false;
+
+        Interpreter interp(out, trace, var, error);
+        std::set<string> builtins;
+        for(auto& [name, value] : interp.global->values)
+            builtins.insert(name);
+        std::map<string, std::vector<Effects>> bodies; // of every def by name, nested ones too
+        index_bodies(parse->ast, bodies);
+
+        std::vector<Record> next;
+        std::set<string> touched;
+        bool touchedAll = false;
+        size_t old = 0; // first record not matched yet
+        executed = skipped = 0;
+        try {
+            for(auto& item : parse->ast->nodes) {
+                Record rec{ast_hash(*item), effects_of(item, bodies, builtins), false, {}};
+                size_t match = old;
+                while(match < records.size() && records[match].hash != rec.hash)
+                    match++;
+                bool changed = match == records.size();
+                if(!changed) {
+                    for(; old < match; old++) // removed or replaced since
+                        touched.insert(records[old].effects.writes.begin(), records[old].effects.writes.end());
+                    old = match + 1;
+                }
+                auto& e = rec.effects;
+                bool stale = touchedAll || meets(e.reads, touched) || meets(e.writes, touched);
+                bool def = item->tag == "function"_;
+
+                if(!changed && !stale && records[match].cached) {
+                    rec.cached = true;
+                    rec.after = std::move(records[match].after);
+                    for(auto& [name, value] : rec.after)
+                        interp.global->set_value(name, value);
+                    skipped++;
+                    next.push_back(std::move(rec));
+                    continue;
+                }
+                bool more = interp.run_item(item);
+                executed++;
+                if(e.opaque)
+                    touchedAll = true;
+                else if(changed || e.external || (stale && !def))
+                    touched.insert(e.writes.begin(), e.writes.end());
+                rec.cached = !def && !e.external && !e.opaque;
+                for(auto it = e.writes.begin(); rec.cached && it != e.writes.end(); ++it) {
+                    if(auto found = interp.global->values.find(*it); found != interp.global->values.end()) {
+                        rec.cached = !holds_code(found->second);
+                        rec.after.emplace(*it, found->second);
+                    }
+                }
+                if(!rec.cached)
+                    rec.after.clear();
+                next.push_back(std::move(rec));
+                if(!more)
+                    break;
+            }
+        } catch(...) {
+            records = std::move(next);
+            throw;
+        }
+        records = std::move(next);
+        return true;
+    }
+
+private:
+    static bool meets(const std::set<string>& names, const std::set<string>& touched) {
+        for(auto& name : names)
+            if(touched.count(name))
+                return true;
+        return false;
+    }
+
+    static void index_bodies(const shared_ptr<Ast>& node, std::map<string, std::vector<Effects>>& bodies) {
+        if(node->tag == "function"_) {
+            Effects e;
+            collect_effects(node->nodes.back(), true, e);
+            bodies[node->nodes[0]->token_to_string()].push_back(std::move(e));
+        }
+        for(auto& child : node->nodes)
+            index_bodies(child, bodies);
+    }
+
+    // The item's own effects plus those of every def it can reach through calls.
+    static Effects effects_of(const shared_ptr<Ast>& item, const std::map<string, std::vector<Effects>>& bodies,
+                              const std::set<string>& builtins) {
+        Effects e;
+        collect_effects(item, false, e);
+        std::vector<string> pending(e.calls.begin(), e.calls.end());
+        std::set<string> followed;
+        while(!pending.empty()) {
+            auto callee = pending.back();
+            pending.pop_back();
+            if(!followed.insert(callee).second)
+                continue;
+            if(effectful_builtins.count(callee))
+                e.external = true;
+            auto it = bodies.find(callee);
+            if(it == bodies.end()) {
+                e.opaque = e.opaque || !builtins.count(callee);
+                continue;
+            }
+            for(auto& body : it->second) {
+                e.reads.insert(body.reads.begin(), body.reads.end());
+                e.writes.insert(body.writes.begin(), body.writes.end());
+                for(auto& c : body.calls)
+                    if(!followed.count(c))
+                        pending.push_back(c);
+            }
+        }
+        return e;
+    }
+};
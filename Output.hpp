@@ -0,0 +1,68 @@
+#pragma once
+
+#include <charconv>
+#include <ostream>
+#include <string>
+
+// Buffered writer behind print(). Line flushes after every print, Block when the buffer
+// fills up, Explicit only on flush() or when the interpreter finishes.
+enum class FlushPolicy { Line, Block, Explicit };
+
+struct OutputBuffer {
+    static constexpr size_t BlockSize = 64 * 1024;
+
+    std::ostream& os;
+    FlushPolicy policy;
+    std::string buf;
+
+    OutputBuffer(std::ostream& os, FlushPolicy policy = FlushPolicy::Line)
+        : os(os), policy(policy) {
+        buf.reserve(BlockSize);
+    }
+    ~OutputBuffer() { flush(); }
+
+    void put(char c) {
+        buf.push_back(c);
+    }
+    void write(const char* s, size_t n) {
+        if(policy == FlushPolicy::Block && buf.size() + n > BlockSize)
+            flush();
+        buf.append(s, n);
+    }
+    void write(long l) {
+        char digits[24];
+        auto res = std::to_chars(digits, digits + sizeof(digits), l);
+        write(digits, res.ptr - digits);
+    }
+    void end_line() {
+        buf.push_back('\n');
+        if(policy == FlushPolicy::Line || (policy == FlushPolicy::Block && buf.size() >= BlockSize))
+            flush();
+    }
+    void flush() {
+        if(!buf.empty()) {
+            os.write(buf.data(), buf.size());
+            buf.clear();
+        }
+        os.flush();
+    }
+};
+
+// Adapters so Value::write can target a plain string or ostream as well.
+struct StringSink {
+    std::string& out;
+    void put(char c) { out.push_back(c); }
+    void write(const char* s, size_t n) { out.append(s, n); }
+    void write(long l) {
+        char digits[24];
+        auto res = std::to_chars(digits, digits + sizeof(digits), l);
+        out.append(digits, res.ptr - digits);
+    }
+};
+
+struct StreamSink {
+    std::ostream& os;
+    void put(char c) { os.put(c); }
+    void write(const char* s, size_t n) { os.write(s, n); }
+    void write(long l) { os << l; }
+};
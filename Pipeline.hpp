@@ -0,0 +1,110 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <string_view>
+#include <thread>
+
+#include "Include/peglib.h"
+#include "Interpreter.hpp"
+
+// Pipelined parse-and-run: the calling thread parses the program one top-level item at a time
+// with parser.parse_prefix() and hands each optimized item to an interpreter thread through a
+// bounded queue, so the first statements run while the rest of a long script is still being
+// parsed. Passes over the whole program (inlining, type checking, the AST cache) don't apply,
+// and a syntax error stops the program at the item it's in, after the ones before it have run.
+
+// Single producer, single consumer. close() wakes both sides: pop() drains what's left and then
+// fails, push() fails straight away.
+template<typename T>
+struct BoundedQueue {
+    explicit BoundedQueue(size_t capacity) : capacity(capacity) {}
+
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [&] { return closed || items.size() < capacity; });
+        if(closed)
+            return false;
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+        return true;
+    }
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [&] { return closed || !items.empty(); });
+        if(items.empty())
+            return false;
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notFull.notify_all();
+        notEmpty.notify_all();
+    }
+
+private:
+    size_t capacity;
+    std::deque<T> items;
+    bool closed = false;
+    std::mutex mutex;
+    std::condition_variable notFull, notEmpty;
+};
+
+struct PipelineResult {
+    bool parsed = true; // false if parsing stopped at a syntax error
+    size_t items = 0;   // top-level items parsed
+};
+
+// The parser's logger runs on the calling thread while the interpreter thread runs. Whatever the
+// interpreter thread throws is rethrown here once both threads are done.
+PipelineResult run_pipelined(const peg::parser& parser, std::string_view source, Interpreter& interp, size_t depth = 16) {
+    BoundedQueue<shared_ptr<Ast>> queue(depth);
+    std::exception_ptr failure;
+    std::thread runner([&] {
+        try {
+            shared_ptr<Ast> item;
+            while(queue.pop(item))
+                if(!interp.run_item(item))
+                    break;
+        } catch(...) {
+            failure = std::current_exception();
+        }
+        queue.close(); // the program is over: stop parsing
+    });
+
+    PipelineResult result;
+    size_t pos = 0, line = 1;
+    auto advance = [&](size_t len) {
+        line += std::count(source.data() + pos, source.data() + pos + len, '\n');
+        pos += len;
+    };
+    while(true) {
+        shared_ptr<Ast> item;
+        size_t len = 0;
+        parser.parse_prefix("Blanks", source.data(), source.size(), pos, line, item, len); // always matches
+        advance(len);
+        if(pos == source.size())
+            break;
+        if(!parser.parse_prefix("item", source.data(), source.size(), pos, line, item, len)) {
+            result.parsed = false;
+            break;
+        }
+        advance(len);
+        result.items++;
+        if(!queue.push(parser.optimize_ast(item)))
+            break;
+    }
+    queue.close();
+    runner.join();
+    if(failure)
+        std::rethrow_exception(failure);
+    return result;
+}
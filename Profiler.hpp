@@ -0,0 +1,105 @@
+#pragma once
+
+#include <csignal>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <sys/time.h>
+
+#include "Ast.hpp"
+
+// Sampling profiler for the interpreter's logical call stack.
+// SIGPROF only bumps a tick counter; the interpreter drains pending ticks at statement
+// boundaries and on frame entry/exit, so the handler never has to touch the heap.
+struct ProfileFrame {
+    const Ast* call = nullptr; // call site that opened this frame, nullptr for <module>
+    const Ast* stmt = nullptr; // statement currently executing in this frame
+};
+
+struct Profiler {
+    bool enabled = false;
+    volatile std::sig_atomic_t ticks = 0;
+    std::vector<ProfileFrame> stack;
+    std::map<std::vector<const Ast*>, size_t> samples; // flattened (call, stmt) pairs -> ticks
+
+    void start(long intervalUs);
+    void stop();
+
+    void poll() {
+        if(ticks) sample();
+    }
+    void sample() {
+        std::sig_atomic_t n = ticks;
+        ticks -= n;
+        std::vector<const Ast*> key;
+        key.reserve(stack.size() * 2);
+        for(auto& f : stack) {
+            key.push_back(f.call);
+            key.push_back(f.stmt);
+        }
+        samples[key] += n;
+    }
+
+    void enter(const Ast* call) {
+        poll();
+        stack.push_back({call, nullptr});
+    }
+    void leave() {
+        poll();
+        stack.pop_back();
+    }
+    void statement(const Ast* stmt) {
+        poll();
+        stack.back().stmt = stmt;
+    }
+
+    // Folded stacks, one per line: "<module>:12:1;fib:4:5;fib:3:9 42"
+    void write_folded(std::ostream& os) const {
+        for(auto& [key, count] : samples) {
+            for(size_t i = 0; i < key.size(); i += 2) {
+                if(i) os << ';';
+                auto call = key[i];
+                auto stmt = key[i + 1];
+                if(call) os << call->nodes[0]->token;
+                else os << "<module>";
+                if(stmt) os << ':' << stmt->line << ':' << stmt->column;
+            }
+            os << ' ' << count << '\n';
+        }
+    }
+};
+
+Profiler profiler;
+
+// Keeps the profiler stack balanced across returns and exceptions.
+struct ProfileScope {
+    explicit ProfileScope(const Ast* call) {
+        if(profiler.enabled) profiler.enter(call);
+    }
+    ~ProfileScope() {
+        if(profiler.enabled) profiler.leave();
+    }
+};
+
+void Profiler::start(long intervalUs) {
+    enabled = true;
+    ticks = 0;
+    stack.assign(1, ProfileFrame{});
+    samples.clear();
+    std::signal(SIGPROF, [](int) { profiler.ticks = profiler.ticks + 1; });
+
+    itimerval timer{};
+    timer.it_interval.tv_sec = intervalUs / 1000000;
+    timer.it_interval.tv_usec = intervalUs % 1000000;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, nullptr);
+}
+
+void Profiler::stop() {
+    itimerval timer{};
+    setitimer(ITIMER_PROF, &timer, nullptr);
+    std::signal(SIGPROF, SIG_IGN);
+    if(enabled) poll();
+    enabled = false;
+}
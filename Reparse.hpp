@@ -0,0 +1,182 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Include/peglib.h"
+#include "Ast.hpp"
+
+// Incremental reparsing for editors and live reload. The program is kept as its top-level items
+// (Grammar.hpp); after a batch of text edits only the items around the changed text are parsed
+// again, starting one item early since a def looks ahead at the line after it. Parsing stops
+// as soon as it ends an item where an old item after the change began: from an item boundary
+// on, the text is the same and so is its parse, so every later item is reused. Items in front of
+// the change keep pointing into the buffer they were parsed from; those after it that the change
+// moved are copied with their lines and positions shifted and their tokens pointing into the new
+// text, which is still far cheaper than parsing.
+//
+// The grammar runs without packrat parsing (see install_hooks), so there are no memo tables to
+// carry over. The parser needs enable_ast<Ast>() and install_hooks(); syntax errors go to its
+// logger.
+
+// Replaces `removed` characters at `offset` with `inserted`. A batch is applied in order, each
+// offset counting in the text as the edits before it left it.
+struct TextEdit {
+    size_t offset;
+    size_t removed;
+    std::string inserted;
+};
+
+// Copy of `node` moved `lines` lines and `bytes` characters further, with its tokens re-pointed
+// from the text at `from` to the same characters in the text at `to`; fresh interpreter state.
+inline std::shared_ptr<Ast> moved_copy(const std::shared_ptr<Ast>& node, long lines, long bytes, const char* from,
+                                       const char* to) {
+    std::shared_ptr<Ast> copy;
+    size_t line = node->line + lines, position = node->position + bytes;
+    if(node->is_token) {
+        std::string_view token(to + (node->token.data() - from) + bytes, node->token.size());
+        copy = std::make_shared<Ast>(node->path.c_str(), line, node->column, node->name.c_str(), token, position,
+                                     node->length, node->choice_count, node->choice);
+    } else {
+        std::vector<std::shared_ptr<Ast>> nodes;
+        nodes.reserve(node->nodes.size());
+        for(auto& child : node->nodes)
+            nodes.push_back(moved_copy(child, lines, bytes, from, to));
+        copy = std::make_shared<Ast>(node->path.c_str(), line, node->column, node->name.c_str(), nodes, position,
+                                     node->length, node->choice_count, node->choice);
+    }
+    // Collapsed by optimize_ast, see AstCache.hpp. peglib hands that constructor its arguments one
+    // slot late, so such a node keeps its start in `length`; shift it there to match a full parse.
+    if(node->original_name != node->name)
+        copy = std::make_shared<Ast>(*copy, node->original_name.c_str(), node->position, node->length + bytes,
+                                     node->original_choice_count, node->original_choice);
+    for(auto& child : copy->nodes)
+        child->parent = copy;
+    return copy;
+}
+
+struct IncrementalParse {
+    // A top-level item and the blank lines before it.
+    struct Item {
+        size_t offset;                            // in the current text
+        size_t length;
+        size_t line;                              // of offset
+        std::shared_ptr<const std::string> source; // the buffer ast's tokens point into
+        std::shared_ptr<Ast> ast;                 // nullptr for text that doesn't parse
+    };
+
+    const peg::parser& parser;
+    std::shared_ptr<const std::string> text;
+    std::vector<Item> items;
+    std::shared_ptr<Ast> ast; // the program, nullptr while the text has a syntax error
+    size_t reparsed = 0;      // items parsed by the last update
+    size_t reused = 0;        // items carried over by it
+
+    IncrementalParse(const peg::parser& parser, std::string source)
+        : parser(parser), text(std::make_shared<const std::string>()) {
+        edit({{0, 0, std::move(source)}});
+    }
+
+    // Applies the edits and reparses what they touched. False on a syntax error, which leaves
+    // the text that failed as one unparsed item so a later edit that fixes it reparses it.
+    bool edit(const std::vector<TextEdit>& edits) {
+        if(edits.empty())
+            return ast != nullptr;
+        // The batch replaces [start, oldEnd) of the old text with [start, newEnd) of the new one.
+        std::string next = *text;
+        size_t start = edits[0].offset, oldEnd = start + edits[0].removed, newEnd = oldEnd;
+        for(auto& e : edits) {
+            size_t end = e.offset + e.removed;
+            start = std::min(start, e.offset); // text in front of the change is where it was
+            if(end > newEnd) {
+                oldEnd += end - newEnd;
+                newEnd = end;
+            }
+            next.replace(e.offset, e.removed, e.inserted);
+            newEnd = newEnd + e.inserted.size() - e.removed;
+        }
+        auto source = std::make_shared<const std::string>(std::move(next));
+        const char* s = source->data();
+
+        // Reparse from the item before the first one touching the change, and stop at the
+        // first old item past it that a new item ends right in front of.
+        size_t first = 0;
+        while(first < items.size() && items[first].offset + items[first].length < start)
+            first++;
+        first = first ? first - 1 : 0;
+        size_t resume = first;
+        while(resume < items.size() && items[resume].offset < oldEnd)
+            resume++;
+        auto moved = [&](size_t i) { return items[i].offset - oldEnd + newEnd; }; // for i >= resume
+
+        size_t pos = 0, line = 1;
+        if(!items.empty())
+            pos = items[first].offset, line = items[first].line;
+        auto advance = [&](size_t len) {
+            line += std::count(s + pos, s + pos + len, '\n');
+            pos += len;
+        };
+        std::vector<Item> parsed;
+        bool ok = true;
+        while(true) {
+            while(resume < items.size() && moved(resume) < pos)
+                resume++;
+            if(resume < items.size() && moved(resume) == pos)
+                break;
+            size_t begin = pos, beginLine = line, len = 0;
+            std::shared_ptr<Ast> item;
+            parser.parse_prefix("Blanks", s, source->size(), pos, line, item, len); // always matches
+            advance(len);
+            if(pos == source->size())
+                break; // trailing blank lines belong to no item
+            if(!parser.parse_prefix("item", s, source->size(), pos, line, item, len)) {
+                // Unparsed up to the next old item, until an edit touches it.
+                ok = false;
+                pos = begin, line = beginLine;
+                size_t end = resume < items.size() ? moved(resume) : source->size();
+                parsed.push_back({begin, end - begin, beginLine, source, nullptr});
+                advance(end - begin);
+                break;
+            }
+            advance(len);
+            parsed.push_back({begin, pos - begin, beginLine, source, parser.optimize_ast(item)});
+        }
+        if(pos == source->size())
+            resume = items.size();
+
+        // Shift the reused tail into place.
+        long lines = resume < items.size() ? (long) line - (long) items[resume].line : 0;
+        long bytes = (long) newEnd - (long) oldEnd;
+        for(size_t i = resume; i < items.size(); i++) {
+            auto& item = items[i];
+            item.offset = moved(i);
+            item.line += lines;
+            if((lines || bytes) && item.ast) {
+                item.ast = moved_copy(item.ast, lines, bytes, item.source->data(), s);
+                item.source = source;
+            }
+        }
+        reparsed = parsed.size();
+        reused = items.size() - resume + first;
+        items.erase(items.begin() + first, items.begin() + resume);
+        items.insert(items.begin() + first, parsed.begin(), parsed.end());
+        text = source;
+
+        ast = nullptr;
+        bool complete = ok;
+        for(auto& item : items)
+            complete = complete && item.ast;
+        if(!complete)
+            return false;
+        std::vector<std::shared_ptr<Ast>> nodes;
+        nodes.reserve(items.size());
+        for(auto& item : items)
+            nodes.push_back(item.ast);
+        ast = std::make_shared<Ast>("", 1, 1, "program", nodes, 0, text->size());
+        for(auto& node : nodes)
+            node->parent = ast;
+        return true;
+    }
+};
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <algorithm>
+#include <ctime>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <poll.h>
+
+// Per-script resource accounting. List and dict storage, Envs and closures allocate through
+// TrackedAllocator; string Values report their heap buffers from Value's special members.
+enum ResourceKind { RString, RList, RDict, RClosure, REnv, RKinds };
+
+struct ResourceError : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+struct ResourceLimits { // 0 means unlimited
+    long long cpuNs = 0;
+    size_t heapBytes = 0;
+    size_t listLength = 0;
+};
+
+struct ResourceUsage {
+    long long cpuNs = 0;
+    size_t allocated[RKinds] = {}; // cumulative bytes per kind
+    size_t liveBytes = 0;
+    size_t peakBytes = 0;
+    size_t largestList = 0;
+};
+
+struct Resources {
+    ResourceLimits limits;
+    ResourceUsage usage;
+    long long cpuStart = 0;
+    unsigned int evals = 0;
+    int hangupFd = -1; // a connection whose peer hanging up ends the run, see Server::handle
+
+    static long long cpu_now() {
+        timespec ts;
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+        return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    }
+    static const char* kind_name(int kind) {
+        static const char* names[RKinds] = {"string", "list", "dict", "closure", "env"};
+        return names[kind];
+    }
+
+    void reset() {
+        usage = ResourceUsage();
+        cpuStart = cpu_now();
+        evals = 0;
+    }
+
+    // Called before the memory is obtained so a rejected allocation leaves nothing behind.
+    void reserve(ResourceKind kind, size_t bytes) {
+        if(limits.heapBytes && usage.liveBytes + bytes > limits.heapBytes)
+            throw ResourceError("ResourceError: heap limit of " + std::to_string(limits.heapBytes) + " bytes exceeded");
+        usage.allocated[kind] += bytes;
+        usage.liveBytes += bytes;
+        usage.peakBytes = std::max(usage.peakBytes, usage.liveBytes);
+    }
+    void release(size_t bytes) {
+        usage.liveBytes -= bytes;
+    }
+    void list_length(size_t n) {
+        if(limits.listLength && n > limits.listLength)
+            throw ResourceError("ResourceError: list of " + std::to_string(n) + " elements exceeds limit of " + std::to_string(limits.listLength));
+        usage.largestList = std::max(usage.largestList, n);
+    }
+    // Cheap enough for every eval(); the clock and the connection are only checked every 1024
+    // calls.
+    void tick() {
+        if((limits.cpuNs || hangupFd >= 0) && (++evals & 1023) == 0)
+            check();
+    }
+    void check() {
+        if(limits.cpuNs && cpu_now() - cpuStart > limits.cpuNs)
+            throw ResourceError("ResourceError: CPU limit of " + std::to_string(limits.cpuNs / 1000000) + " ms exceeded");
+        pollfd p = {hangupFd, POLLRDHUP, 0};
+        if(hangupFd >= 0 && poll(&p, 1, 0) > 0 && (p.revents & (POLLRDHUP | POLLHUP | POLLERR)))
+            throw ResourceError("ResourceError: client disconnected");
+    }
+
+    ResourceUsage snapshot() const {
+        ResourceUsage u = usage;
+        u.cpuNs = cpu_now() - cpuStart;
+        return u;
+    }
+    void report(std::ostream& os) const {
+        auto u = snapshot();
+        os << "cpu_ns: " << u.cpuNs << "\n";
+        for(int k = 0; k < RKinds; k++)
+            os << "allocated_" << kind_name(k) << "_bytes: " << u.allocated[k] << "\n";
+        os << "live_heap_bytes: " << u.liveBytes << "\n";
+        os << "peak_heap_bytes: " << u.peakBytes << "\n";
+        os << "largest_list: " << u.largestList << "\n";
+    }
+};
+
+Resources resources;
+
+ResourceUsage resource_usage() {
+    return resources.snapshot();
+}
+
+template<typename T, ResourceKind Kind>
+struct TrackedAllocator {
+    using value_type = T;
+    template<typename U> struct rebind { using other = TrackedAllocator<U, Kind>; };
+
+    TrackedAllocator() = default;
+    template<typename U>
+    TrackedAllocator(const TrackedAllocator<U, Kind>&) {}
+
+    T* allocate(size_t n) {
+        resources.reserve(Kind, n * sizeof(T));
+        try {
+            return std::allocator<T>().allocate(n);
+        } catch(...) {
+            resources.release(n * sizeof(T));
+            throw;
+        }
+    }
+    void deallocate(T* p, size_t n) {
+        resources.release(n * sizeof(T));
+        std::allocator<T>().deallocate(p, n);
+    }
+
+    friend bool operator==(const TrackedAllocator&, const TrackedAllocator&) { return true; }
+    friend bool operator!=(const TrackedAllocator&, const TrackedAllocator&) { return false; }
+};
@@ -0,0 +1,373 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <csignal>
+#include <limits.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "Include/peglib.h"
+#include "Interpreter.hpp"
+#include "TypeCheck.hpp"
+#include "Inline.hpp"
+#include "Grammar.hpp"
+#include "AstCache.hpp"
+#include "MappedFile.hpp"
+
+// Warm daemon: `minipython --serve sock` builds the parser once and keeps the scripts it has
+// parsed, optimized, inlined and type checked, so a run request only pays for interpreting.
+// `minipython --client sock script.py` sends one and relays what comes back. A script sent by
+// path is parsed again once its size or mtime changes; one sent as source is keyed by its hash.
+// Requests are served one at a time, since the interpreter's logs, stats and resource
+// accounting are process-wide. A run ends when its client hangs up, and a client that stops
+// sending or reading for RequestTimeoutSec is dropped, so one bad client can't stall the rest.
+//
+// One request per connection, as frames of a type byte, a u32 length (host order, both ends
+// are on one machine) and the payload:
+//   client -> daemon  'A' run option*  then 'P' script path or 'S' script source
+//   daemon -> client  'O' stdout bytes*  'E' stderr bytes*  then 'X' exit status, one byte
+// The run options are --flush=... and the --max-... resource limits.
+
+bool write_all(int fd, const char* p, size_t n) {
+    while(n) {
+        ssize_t w = send(fd, p, n, MSG_NOSIGNAL);
+        if(w < 0 && errno == EINTR)
+            continue;
+        if(w <= 0)
+            return false;
+        p += w, n -= w;
+    }
+    return true;
+}
+
+bool read_all(int fd, char* p, size_t n) {
+    while(n) {
+        ssize_t r = read(fd, p, n);
+        if(r < 0 && errno == EINTR)
+            continue;
+        if(r <= 0)
+            return false;
+        p += r, n -= r;
+    }
+    return true;
+}
+
+bool write_frame(int fd, char type, std::string_view payload) {
+    char header[5] = {type};
+    uint32_t len = payload.size();
+    memcpy(header + 1, &len, 4);
+    return write_all(fd, header, 5) && write_all(fd, payload.data(), payload.size());
+}
+
+bool read_frame(int fd, char& type, std::string& payload) {
+    char header[5];
+    if(!read_all(fd, header, 5))
+        return false;
+    type = header[0];
+    uint32_t len;
+    memcpy(&len, header + 1, 4);
+    payload.resize(len);
+    return read_all(fd, payload.data(), len);
+}
+
+// Sends whatever is written to it as frames of one type. print() output arrives in the
+// interpreter's OutputBuffer blocks, so this adds no buffering of its own.
+struct FrameBuf : std::streambuf {
+    int fd;
+    char type;
+    FrameBuf(int fd, char type) : fd(fd), type(type) {}
+
+protected:
+    std::streamsize xsputn(const char* s, std::streamsize n) override {
+        return write_frame(fd, type, std::string_view(s, n)) ? n : 0;
+    }
+    int_type overflow(int_type c) override {
+        if(traits_type::eq_int_type(c, traits_type::eof()))
+            return traits_type::not_eof(c);
+        char ch = traits_type::to_char_type(c);
+        return write_frame(fd, type, std::string_view(&ch, 1)) ? c : traits_type::eof();
+    }
+};
+
+int connect_unix(const std::string& path, bool listening) {
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if(path.size() >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0)
+        return -1;
+    bool ok = listening ? bind(fd, (sockaddr*) &addr, sizeof(addr)) == 0 && listen(fd, 64) == 0
+                        : connect(fd, (sockaddr*) &addr, sizeof(addr)) == 0;
+    if(!ok) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+// Applies one of the run options to a run's settings; false if it isn't one.
+bool apply_run_option(const std::string& arg, FlushPolicy& flush, ResourceLimits& limits) {
+    if(arg == "--flush=line")
+        flush = FlushPolicy::Line;
+    else if(arg == "--flush=block")
+        flush = FlushPolicy::Block;
+    else if(arg == "--flush=explicit")
+        flush = FlushPolicy::Explicit;
+    else if(arg.rfind("--max-cpu-ms=", 0) == 0)
+        limits.cpuNs = std::stoll(arg.substr(13)) * 1000000;
+    else if(arg.rfind("--max-heap=", 0) == 0)
+        limits.heapBytes = std::stoull(arg.substr(11));
+    else if(arg.rfind("--max-list=", 0) == 0)
+        limits.listLength = std::stoull(arg.substr(11));
+    else
+        return false;
+    return true;
+}
+
+struct Server {
+    // A script ready to run, or the diagnostics that keep it from running.
+    struct Entry {
+        std::shared_ptr<const std::string> source; // the tree's tokens point into it
+        std::shared_ptr<Ast> ast;                  // nullptr if it didn't parse or check
+        std::string diagnostics;
+        off_t size = 0;
+        timespec mtime = {};
+        uint64_t lastUse = 0;
+    };
+    static constexpr size_t MaxScripts = 64;
+    static constexpr int RequestTimeoutSec = 10;
+
+    bool typecheck, inlining;
+    FlushPolicy flush;
+    ResourceLimits limits; // defaults for runs that don't set their own
+    peg::parser parser;
+    std::string syntaxErrors;
+    std::map<std::string, Entry> scripts; // by path, or by "#" and the hash of a sent source
+    uint64_t requests = 0;
+
+    Server(bool typecheck, bool inlining, FlushPolicy flush, ResourceLimits limits)
+        : typecheck(typecheck), inlining(inlining), flush(flush), limits(limits), parser(minipython_grammar) {
+        if(!parser)
+            throw std::runtime_error("Could not generate a parser from defined grammar.");
+        install_hooks(parser);
+        parser.enable_ast<Ast>();
+        parser.set_logger([this](size_t line, size_t col, const std::string& msg, const std::string& rule) {
+            syntaxErrors += std::to_string(line) + ":" + std::to_string(col) + ": " + msg + " | rule: " + rule + "\n";
+        });
+    }
+    Server(const Server&) = delete;
+
+    // Parses and prepares a script the way the driver does.
+    Entry compile(std::string source) {
+        Entry entry;
+        entry.source = std::make_shared<const std::string>(std::move(source));
+        syntaxErrors.clear();
+        std::shared_ptr<Ast> ast;
+        if(!parser.parse(*entry.source, ast)) {
+            entry.diagnostics = syntaxErrors + "Syntax error, could not parse\n";
+            return entry;
+        }
+        ast = parser.optimize_ast(ast);
+        if(inlining)
+            Inliner().run(ast);
+        if(typecheck) {
+            TypeChecker checker;
+            checker.check(ast);
+            for(auto& e : checker.errors)
+                entry.diagnostics += std::to_string(e.line) + ":" + std::to_string(e.column) + ": " + e.message + "\n";
+            if(!checker.errors.empty())
+                return entry;
+        }
+        entry.ast = ast;
+        return entry;
+    }
+
+    // The cached entry for a script path, compiled again if the file changed; nullptr if it
+    // can't be read.
+    Entry* script_at(const std::string& path) {
+        struct stat st;
+        if(stat(path.c_str(), &st) != 0)
+            return nullptr;
+        auto it = scripts.find(path);
+        if(it != scripts.end() && it->second.size == st.st_size && it->second.mtime.tv_sec == st.st_mtim.tv_sec
+           && it->second.mtime.tv_nsec == st.st_mtim.tv_nsec)
+            return &it->second;
+        MappedFile file;
+        if(!file.open(path))
+            return nullptr;
+        Entry entry = compile(std::string(file.view())); // copied: the file may change under a mapping
+        entry.size = st.st_size;
+        entry.mtime = st.st_mtim;
+        return &store(path, std::move(entry));
+    }
+
+    Entry* script_from(std::string source) {
+        auto key = "#" + std::to_string(ast_cache::fnv1a(source));
+        auto it = scripts.find(key);
+        if(it != scripts.end() && *it->second.source == source)
+            return &it->second;
+        return &store(key, compile(std::move(source)));
+    }
+
+    Entry& store(const std::string& key, Entry entry) {
+        if(scripts.size() >= MaxScripts && !scripts.count(key)) {
+            auto oldest = scripts.begin();
+            for(auto it = scripts.begin(); it != scripts.end(); ++it)
+                if(it->second.lastUse < oldest->second.lastUse)
+                    oldest = it;
+            scripts.erase(oldest);
+        }
+        return scripts[key] = std::move(entry);
+    }
+
+    void handle(int fd) {
+        FlushPolicy runFlush = flush;
+        ResourceLimits runLimits = limits;
+        Entry* script = nullptr;
+        char type;
+        std::string payload;
+        while(!script) {
+            if(!read_frame(fd, type, payload))
+                return; // the client went away
+            if(type == 'A') {
+                bool ok = false;
+                try {
+                    ok = apply_run_option(payload, runFlush, runLimits);
+                } catch(const std::exception&) {
+                }
+                if(!ok) {
+                    write_frame(fd, 'E', "Unknown run option " + payload + "\n");
+                    write_frame(fd, 'X', std::string(1, EXIT_FAILURE));
+                    return;
+                }
+            } else if(type == 'P' || type == 'S') {
+                script = type == 'P' ? script_at(payload) : script_from(std::move(payload));
+                if(!script) {
+                    write_frame(fd, 'E', "Could not open source file\n");
+                    write_frame(fd, 'X', std::string(1, EXIT_FAILURE));
+                    return;
+                }
+            } else {
+                return;
+            }
+        }
+        script->lastUse = ++requests;
+        if(!script->ast) {
+            write_frame(fd, 'E', script->diagnostics);
+            write_frame(fd, 'X', std::string(1, EXIT_FAILURE));
+            return;
+        }
+
+        char status = EXIT_SUCCESS;
+        FrameBuf outBuf(fd, 'O');
+        std::ostream out(&outBuf);
+        std::ostream discard(nullptr); // no trace or variable logs
+        resources.limits = runLimits;
+        resources.hangupFd = fd;
+        try {
+            Interpreter interp(out, discard, discard, discard, runFlush);
+            interp.run(script->ast);
+        } catch(const std::exception& e) {
+            write_frame(fd, 'E', std::string(e.what()) + "\n");
+            status = EXIT_FAILURE;
+        }
+        resources.hangupFd = -1;
+        write_frame(fd, 'X', std::string(1, status));
+    }
+
+    // Serves until killed. A stale socket file left at the path is replaced.
+    int serve(const std::string& socketPath) {
+        struct stat st;
+        if(lstat(socketPath.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+            unlink(socketPath.c_str());
+        int listener = connect_unix(socketPath, true);
+        if(listener < 0) {
+            std::cerr << "Could not listen on " << socketPath << ": " << strerror(errno) << std::endl;
+            return EXIT_FAILURE;
+        }
+        signal(SIGPIPE, SIG_IGN);
+        while(true) {
+            int fd = accept(listener, nullptr, nullptr);
+            if(fd < 0) {
+                if(errno == EINTR || errno == ECONNABORTED)
+                    continue;
+                std::cerr << "accept: " << strerror(errno) << std::endl;
+                close(listener);
+                return EXIT_FAILURE;
+            }
+            timeval timeout = {RequestTimeoutSec, 0};
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+            handle(fd);
+            close(fd);
+        }
+    }
+};
+
+// Sends one run request and relays the output; returns the script's exit status. A script
+// named "-" is read from stdin and sent as source.
+int run_client(const std::string& socketPath, const std::vector<std::string>& options, const std::string& script) {
+    std::string payload;
+    char kind = 'P';
+    if(script == "-") {
+        kind = 'S';
+        payload.assign(std::istreambuf_iterator<char>(std::cin), std::istreambuf_iterator<char>());
+    } else {
+        char resolved[PATH_MAX];
+        if(!realpath(script.c_str(), resolved)) { // the daemon has its own working directory
+            std::cerr << "Could not open source file" << std::endl;
+            return EXIT_FAILURE;
+        }
+        payload = resolved;
+    }
+    int fd = connect_unix(socketPath, false);
+    if(fd < 0) {
+        std::cerr << "Could not connect to " << socketPath << ": " << strerror(errno) << std::endl;
+        return EXIT_FAILURE;
+    }
+    bool sent = true;
+    for(auto& option : options)
+        sent = sent && write_frame(fd, 'A', option);
+    sent = sent && write_frame(fd, kind, payload);
+
+    char type;
+    std::string data;
+    while(sent && read_frame(fd, type, data)) {
+        if(type == 'O')
+            fwrite(data.data(), 1, data.size(), stdout);
+        else if(type == 'E') {
+            fflush(stdout); // keep the order they were written in
+            fwrite(data.data(), 1, data.size(), stderr);
+        }
+        else if(type == 'X' && data.size() == 1) {
+            close(fd);
+            fflush(stdout);
+            return data[0];
+        }
+    }
+    close(fd);
+    fflush(stdout);
+    std::cerr << "Lost the connection to " << socketPath << std::endl;
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,385 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <string_view>
+#include <typeindex>
+#include <vector>
+
+#include "Interpreter.hpp"
+#include "AstCache.hpp"
+#include "MappedFile.hpp"
+
+// Warm starts from a saved global Env. A script marks the end of its setup with a top-level
+// `snapshot()`; run with --snapshot=FILE, that call writes every global the setup bound to
+// FILE, together with the Envs captured by its functions and the program tree their bodies
+// come from. The next run of the same script maps FILE, rebuilds the globals from it and starts
+// right after the snapshot() statement, so the setup code doesn't run at all. The file is only
+// used while the source up to the end of that statement is unchanged; otherwise the setup runs
+// again and the file is rewritten.
+//
+// Builtins and other host functions bound in the global Env under their own names aren't
+// saved, the interpreter they're restored into registers its own. One held anywhere else, as
+// in `p = print`, is saved as that name and rebound to the target's function of that name.
+// Function bodies are rebuilt with their tokens pointing into the mapping, which has to outlive
+// them.
+//
+// Layout, integers little-endian as written by the host:
+//   "MPYS" u32 format  u64 setupHash  u32 setupEnd  u32 item
+//   u32 nameCount { u32 len, bytes }*  program node (see AstCache.hpp)
+//   u32 envCount { u32 outer + 1 }*    Env 0 is the global one, every outer comes first
+//   u32 closureCount { u32 def, u32 env, u32 len, name }*   def: index among the program's
+//                                                            function nodes in preorder
+//   per Env: u32 count { u32 len, name, value }*
+//   value := u8 type then nothing (None), u8 (bool), i64 (int), u32 len, bytes (string),
+//            u32 closure (function), u32 count, value* (list), u32 len, name (host function),
+//            u32 count, { key, value }* (dict), i64 start, i64 stop, i64 step (range)
+namespace snapshot {
+
+constexpr uint32_t Format = 2;
+
+inline void collect_defs(const shared_ptr<Ast>& node, std::vector<shared_ptr<Ast>>& defs) {
+    if(node->tag == "function"_)
+        defs.push_back(node);
+    for(auto& child : node->nodes)
+        collect_defs(child, defs);
+}
+
+// Global names the program itself binds; any other global holding a host function was
+// registered by the interpreter. Function bodies and comprehensions have their own scopes.
+inline void collect_bound(const shared_ptr<Ast>& node, std::set<string>& out) {
+    switch(node->tag) {
+        case "assignment"_: case "list_create"_: case "for"_:
+            out.insert(node->nodes[0]->token_to_string());
+            break;
+        case "function"_:
+            out.insert(node->nodes[0]->token_to_string());
+            return;
+        case "list_comp"_:
+            return;
+    }
+    for(auto& child : node->nodes)
+        collect_bound(child, out);
+}
+
+inline bool is_host(const Value& v) {
+    return v.v.index() == 6 || (v.v.index() == 4 && !std::get<Function>(v.v).target<UserFunction>());
+}
+inline const std::type_info& host_type(const Value& v) {
+    return v.v.index() == 6 ? std::get<Native>(v.v).target_type() : std::get<Function>(v.v).target_type();
+}
+
+inline const Ast* root_of(const Ast* node) {
+    while(auto parent = node->parent.lock())
+        node = parent.get();
+    return node;
+}
+
+struct Saver {
+    shared_ptr<Ast> program;
+    std::map<const Ast*, uint32_t> defs;
+    std::map<const Env*, uint32_t> envIds;
+    std::vector<const Env*> envs;
+    std::map<const Closure*, uint32_t> closureIds;
+    std::vector<const Closure*> closures;
+    std::set<string> bound;
+    std::map<std::type_index, string> hostNames; // "" when two registered names share a type
+    ast_cache::Writer bindings;
+
+    explicit Saver(shared_ptr<Ast> program) : program(program) {
+        std::vector<shared_ptr<Ast>> order;
+        collect_defs(program, order);
+        for(uint32_t i = 0; i < order.size(); i++)
+            defs[order[i].get()] = i;
+        collect_bound(program, bound);
+    }
+
+    // Host functions are told apart by the type of their callable, unique per registered lambda.
+    void collect_host_names(const Env& global) {
+        for(auto& [name, v] : global.values) {
+            if(!is_host(v) || bound.count(name))
+                continue;
+            auto [it, added] = hostNames.emplace(host_type(v), name);
+            if(!added)
+                it->second.clear();
+        }
+    }
+
+    uint32_t env_id(const Env* env) {
+        if(auto it = envIds.find(env); it != envIds.end())
+            return it->second;
+        if(env->outer)
+            env_id(env->outer.get());
+        envs.push_back(env);
+        return envIds[env] = envs.size() - 1;
+    }
+    uint32_t closure_id(const Closure* closure) {
+        if(auto it = closureIds.find(closure); it != closureIds.end())
+            return it->second;
+        if(root_of(closure->decl.get()) != program.get())
+            throw std::runtime_error("TypeError: snapshot() cannot save '" + closure->name + "', defined outside this program");
+        env_id(closure->env.get());
+        closures.push_back(closure);
+        return closureIds[closure] = closures.size() - 1;
+    }
+
+    void i64(long l) { bindings.out.append(reinterpret_cast<const char*>(&l), 8); }
+    void value(const Value& v, const string& name) {
+        bindings.out.push_back(v.v.index());
+        switch(v.v.index()) {
+            case 1: bindings.out.push_back(std::get<bool>(v.v)); break;
+            case 2: i64(std::get<long>(v.v)); break;
+            case 3: bindings.bytes(std::get<string>(v.v)); break;
+            case 4: case 6: {
+                if(is_host(v)) {
+                    auto it = hostNames.find(host_type(v));
+                    if(it == hostNames.end() || it->second.empty())
+                        throw std::runtime_error("TypeError: snapshot() cannot save the host function in '" + name + "'");
+                    bindings.out.back() = 6;
+                    bindings.bytes(it->second);
+                    break;
+                }
+                bindings.u32(closure_id(std::get<Function>(v.v).target<UserFunction>()->closure.get()));
+                break;
+            }
+            case 5: {
+                auto& list = std::get<List>(v.v);
+                bindings.u32(list.size());
+                for(auto& item : list)
+                    value(item, name);
+                break;
+            }
+            case 7: {
+                auto& dict = std::get<Dict>(v.v);
+                bindings.u32(dict.size());
+                for(size_t i = 0; i < dict.size(); i++) {
+                    value(dict.keys[i], name);
+                    value(dict.values[i], name);
+                }
+                break;
+            }
+            case 8: {
+                auto& r = std::get<Range>(v.v);
+                i64(r.start), i64(r.stop), i64(r.step);
+                break;
+            }
+            case 9:
+                throw std::runtime_error("TypeError: snapshot() cannot save the open file in '" + name + "'");
+        }
+    }
+
+    // Saves the globals and everything reachable from them.
+    std::string save(const Env& global, uint64_t setupHash, uint32_t setupEnd, uint32_t item) {
+        env_id(&global);
+        collect_host_names(global);
+        for(size_t e = 0; e < envs.size(); e++) { // grows as closures turn up
+            std::vector<const std::pair<const string, Value>*> saved;
+            for(auto& binding : envs[e]->values)
+                if(!(e == 0 && is_host(binding.second) && !bound.count(binding.first)))
+                    saved.push_back(&binding);
+            bindings.u32(saved.size());
+            for(auto binding : saved) {
+                bindings.bytes(binding->first);
+                value(binding->second, binding->first);
+            }
+        }
+
+        ast_cache::Writer w;
+        w.node(*program);
+        w.u32(envs.size());
+        for(auto env : envs)
+            w.u32(env->outer ? envIds.at(env->outer.get()) + 1 : 0);
+        w.u32(closures.size());
+        for(auto closure : closures) {
+            w.u32(defs.at(closure->decl.get()));
+            w.u32(envIds.at(closure->env.get()));
+            w.bytes(closure->name);
+        }
+
+        ast_cache::Writer h;
+        h.out = "MPYS";
+        h.u32(Format);
+        h.out.append(reinterpret_cast<const char*>(&setupHash), 8);
+        h.u32(setupEnd);
+        h.u32(item);
+        h.u32(w.names.size());
+        for(auto& n : w.names)
+            h.bytes(n);
+        return h.out + w.out + bindings.out;
+    }
+};
+
+struct Loader {
+    ast_cache::Reader r;
+    std::vector<shared_ptr<Env>> envs;
+    std::vector<Function> closures;
+
+    explicit Loader(const MappedFile& file) : r(file.data(), file.data() + file.size()) {}
+
+    long i64() {
+        long l = 0;
+        if(r.end - r.p < 8)
+            return r.ok = false, 0;
+        std::memcpy(&l, r.p, 8);
+        r.p += 8;
+        return l;
+    }
+    Value value(int depth = 0) {
+        if(r.p >= r.end || depth > 10000)
+            return r.ok = false, Value();
+        switch(*r.p++) {
+            case 0: return Value();
+            case 1: return r.p < r.end ? Value((bool) *r.p++) : (r.ok = false, Value());
+            case 2: return Value(i64());
+            case 3: return Value(string(r.bytes()));
+            case 4: {
+                uint32_t id = r.u32();
+                if(id >= closures.size())
+                    return r.ok = false, Value();
+                return Value(closures[id]);
+            }
+            case 6: {
+                auto name = r.bytes();
+                auto it = r.ok ? envs[0]->values.find(string(name)) : envs[0]->values.end();
+                if(it == envs[0]->values.end() || !is_host(it->second))
+                    return r.ok = false, Value(); // the target has no such host function
+                return it->second;
+            }
+            case 5: {
+                uint32_t n = r.u32();
+                List list;
+                for(uint32_t i = 0; r.ok && i < n; i++)
+                    list.push_back(value(depth + 1));
+                return Value(std::move(list));
+            }
+            case 7: {
+                uint32_t n = r.u32();
+                Dict dict;
+                for(uint32_t i = 0; r.ok && i < n; i++) {
+                    auto key = value(depth + 1);
+                    auto val = value(depth + 1);
+                    if(r.ok)
+                        dict[key] = std::move(val);
+                }
+                return Value(std::move(dict));
+            }
+            case 8: {
+                long start = i64(), stop = i64(), step = i64();
+                return Value(Range{start, stop, step});
+            }
+        }
+        return r.ok = false, Value();
+    }
+};
+
+// Header of a snapshot file: which setup it was taken after.
+struct Header {
+    uint64_t setupHash = 0;
+    uint32_t setupEnd = 0;
+    uint32_t item = 0;
+};
+
+inline bool read_header(ast_cache::Reader& r, Header& h) {
+    if(r.end - r.p < 24 || std::memcmp(r.p, "MPYS", 4) != 0)
+        return false;
+    r.p += 4;
+    if(r.u32() != Format)
+        return false;
+    std::memcpy(&h.setupHash, r.p, 8);
+    r.p += 8;
+    h.setupEnd = r.u32();
+    h.item = r.u32();
+    return r.ok;
+}
+
+// Hash of the source a snapshot taken at the end of top-level `item` depends on.
+inline uint64_t setup_hash(std::string_view source, const Ast& item) {
+    return ast_cache::fnv1a(source.substr(0, item.position + item.length));
+}
+
+} // namespace snapshot
+
+// Binds `snapshot()` to write the interpreter's globals to `path`; `program` and `source` are
+// the tree being run and the text it was parsed from.
+void enable_snapshots(Interpreter& interp, const string& path, shared_ptr<Ast> program, std::string_view source) {
+    interp.global->set_value("snapshot", Value(Native([path, program, source](const shared_ptr<Ast>& call, const shared_ptr<Env>& env) {
+        check_arity("snapshot", call->nodes.size() - 1, 0, 0);
+        size_t item = 0;
+        while(item < program->nodes.size() && program->nodes[item] != call)
+            item++;
+        if(item == program->nodes.size())
+            throw std::runtime_error("TypeError: snapshot() must be a top-level statement");
+        auto& stmt = *program->nodes[item];
+        auto data = snapshot::Saver(program).save(*env->global, snapshot::setup_hash(source, stmt),
+                                                      stmt.position + stmt.length, item);
+        std::string tmp = path + ".tmp";
+        {
+            std::ofstream f(tmp, std::ios::out | std::ios::binary | std::ios::trunc);
+            f << data;
+            if(!f)
+                throw std::runtime_error("OSError: could not write snapshot " + path);
+        }
+        std::rename(tmp.c_str(), path.c_str()); // readers never see a partial file
+        return Value();
+    })));
+}
+
+// Restores the globals saved in `file` into the interpreter if they were taken after the same
+// setup of `source`; returns the index of the program item to continue after, or -1 if the file
+// doesn't apply. `file` has to outlive the interpreter.
+long restore_snapshot(Interpreter& interp, const MappedFile& file, std::string_view source) {
+    snapshot::Loader l(file);
+    auto& r = l.r;
+    snapshot::Header h;
+    if(!snapshot::read_header(r, h) || h.setupEnd > source.size()
+       || ast_cache::fnv1a(source.substr(0, h.setupEnd)) != h.setupHash)
+        return -1;
+    uint32_t count = r.u32();
+    for(uint32_t i = 0; r.ok && i < count; i++)
+        r.names.emplace_back(r.bytes());
+    auto program = r.ok ? r.node() : nullptr;
+    if(!program)
+        return -1;
+    std::set<string> locals; // as Interpreter::run marks the whole program
+    collect_local_names(program, false, locals);
+    mark_global_names(program, locals);
+    std::vector<shared_ptr<Ast>> defs;
+    snapshot::collect_defs(program, defs);
+
+    uint32_t envCount = r.u32();
+    for(uint32_t i = 0; r.ok && i < envCount; i++) {
+        uint32_t outer = r.u32();
+        if(i == 0 ? outer != 0 : outer == 0 || outer > i)
+            return -1;
+        l.envs.push_back(i == 0 ? interp.global : make_env(l.envs[outer - 1]));
+    }
+    uint32_t closureCount = r.u32();
+    for(uint32_t i = 0; r.ok && i < closureCount; i++) {
+        uint32_t def = r.u32(), env = r.u32();
+        auto name = r.bytes();
+        if(!r.ok || def >= defs.size() || env >= l.envs.size())
+            return -1;
+        auto closure = std::allocate_shared<Closure>(TrackedAllocator<Closure, RClosure>(), Closure{defs[def], l.envs[env], string(name)});
+        l.closures.push_back(Function(UserFunction{closure}));
+    }
+    // Read everything before binding anything, so a damaged file leaves the globals alone.
+    std::vector<std::vector<std::pair<string, Value>>> bindings(l.envs.size());
+    for(auto& env : bindings) {
+        uint32_t n = r.u32();
+        for(uint32_t i = 0; r.ok && i < n; i++) {
+            string name(r.bytes());
+            env.emplace_back(std::move(name), l.value());
+        }
+    }
+    if(!r.ok || r.p != r.end)
+        return -1;
+    for(size_t e = 0; e < l.envs.size(); e++)
+        for(auto& [name, value] : bindings[e])
+            l.envs[e]->set_value(name, value);
+    return h.item;
+}
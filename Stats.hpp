@@ -0,0 +1,104 @@
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Ast.hpp"
+
+// Execution statistics for --stats. Counters are plain increments and always on so runs
+// stay comparable; per-node timing is only taken when enabled.
+struct Stats {
+    using Clock = std::chrono::steady_clock;
+
+    struct Node {
+        std::string name;
+        size_t count = 0;
+        long long ns = 0; // self time, child evaluations excluded
+    };
+
+    bool enabled = false;
+    std::vector<std::pair<std::string, long long>> phases;
+    std::unordered_map<unsigned int, Node> nodes; // keyed by AST tag
+
+    long long childNs = 0; // time spent in children of the node being timed
+
+    size_t envLookups = 0; // Env::get_value calls made by the interpreter
+    size_t envHops = 0;    // outer scopes walked while resolving them
+    size_t cacheHits = 0;  // global names resolved from their node's inline cache
+    size_t envAllocs = 0;
+    size_t listCopies = 0;
+    size_t valueAllocs = 0; // string, list and function Values constructed
+    size_t quickened = 0;   // expression nodes specialized after their first run
+    size_t deopts = 0;      // specializations dropped after a failed type guard
+    size_t inlined = 0;     // call sites replaced by the callee's return expression
+    size_t lazyParsed = 0;  // skimmed function bodies parsed on their first call
+
+    static Clock::time_point now() {
+        return Clock::now();
+    }
+    // Record the time elapsed since `since` under `name` and return the new start point.
+    Clock::time_point phase(const std::string& name, Clock::time_point since) {
+        auto t = now();
+        phases.emplace_back(name, std::chrono::duration_cast<std::chrono::nanoseconds>(t - since).count());
+        return t;
+    }
+
+    void write_json(std::ostream& os) const {
+        os << "{\n  \"phases_ns\": {";
+        for(size_t i = 0; i < phases.size(); i++)
+            os << (i ? ", " : "") << '"' << phases[i].first << "\": " << phases[i].second;
+        os << "},\n  \"nodes\": {";
+        std::map<std::string, Node> sorted;
+        for(auto& [tag, n] : nodes)
+            sorted[n.name] = n;
+        bool first = true;
+        for(auto& [name, n] : sorted) {
+            os << (first ? "\n" : ",\n") << "    \"" << name << "\": {\"count\": " << n.count << ", \"self_ns\": " << n.ns << "}";
+            first = false;
+        }
+        os << "\n  },\n  \"counters\": {"
+           << "\"env_lookups\": " << envLookups
+           << ", \"env_hops\": " << envHops
+           << ", \"inline_cache_hits\": " << cacheHits
+           << ", \"env_allocs\": " << envAllocs
+           << ", \"list_copies\": " << listCopies
+           << ", \"value_allocs\": " << valueAllocs
+           << ", \"quickened\": " << quickened
+           << ", \"deopts\": " << deopts
+           << ", \"inlined\": " << inlined
+           << ", \"lazy_parsed\": " << lazyParsed
+           << "}\n}\n";
+    }
+};
+
+Stats stats;
+
+// Charges the self time of one eval() call to the node's rule name.
+struct NodeTimer {
+    const Ast* ast = nullptr;
+    long long outerChildNs = 0;
+    Stats::Clock::time_point start;
+
+    explicit NodeTimer(const Ast* node) {
+        if(stats.enabled) {
+            ast = node;
+            outerChildNs = stats.childNs;
+            stats.childNs = 0;
+            start = Stats::now();
+        }
+    }
+    ~NodeTimer() {
+        if(ast) {
+            long long total = std::chrono::duration_cast<std::chrono::nanoseconds>(Stats::now() - start).count();
+            auto& n = stats.nodes[ast->tag];
+            if(n.count++ == 0) n.name = ast->name;
+            n.ns += total - stats.childNs;
+            stats.childNs = outerChildNs + total;
+        }
+    }
+};
@@ -0,0 +1,458 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "Ast.hpp"
+
+using namespace peg::udl;
+
+// Flow-sensitive type inference over the optimized AST, run once before interpretation.
+// Every expression gets the Type it is guaranteed to have on all paths (or TUnknown), and
+// expressions whose form follows from those types are specialized up front. Operations that
+// are certain to throw a TypeError are reported with their line and column instead of being
+// discovered at runtime; anything the pass can't prove is left to the dynamic checks.
+//
+// Function bodies are checked once with unknown parameters and without the caller's globals,
+// since functions can't rebind outer names. They can still mutate outer lists in place, so a
+// call to anything but a known builtin forgets which lists hold only ints.
+
+struct TypeDiagnostic {
+    size_t line, column;
+    std::string message;
+};
+
+using TypeEnv = std::map<std::string, Type>; // variable -> type at the current program point
+
+const char* type_name(Type t) {
+    static const char* names[] = {"unknown", "None", "bool", "int", "string", "list", "list", "function", "dict", "range"};
+    return names[t];
+}
+
+bool is_list(Type t) {
+    return t == TList || t == TIntList;
+}
+
+Type join(Type a, Type b) {
+    if(a == b)
+        return a;
+    if(is_list(a) && is_list(b))
+        return TList;
+    return TUnknown;
+}
+
+// Names bound on only one side may be undefined after the merge, so they are dropped.
+TypeEnv join(const TypeEnv& a, const TypeEnv& b) {
+    TypeEnv out;
+    for(auto& [name, t] : a)
+        if(auto it = b.find(name); it != b.end())
+            if(Type j = join(t, it->second); j != TUnknown)
+                out[name] = j;
+    return out;
+}
+
+// Result types of the builtins registered by interpret(); TUnknown when they depend on values.
+Type builtin_result(const std::string& fn, const std::vector<Type>& args) {
+    auto arg = [&](size_t i) { return i < args.size() ? args[i] : TUnknown; };
+    bool ints = arg(0) == TIntList || arg(0) == TRange;
+    if(fn == "print" || fn == "flush" || fn == "snapshot" || fn == "write_lines" || fn == "append" || fn == "extend"
+       || fn == "insert")
+        return TNil;
+    if(fn == "len" || fn == "sum" || fn == "abs" || fn == "int")
+        return TInt;
+    if(fn == "str")
+        return TString;
+    if(fn == "range")
+        return TRange;
+    if(fn == "list" || fn == "sorted")
+        return ints ? TIntList : TList;
+    if(fn == "pop")
+        return arg(0) == TIntList ? TInt : TUnknown;
+    if(fn == "min" || fn == "max") {
+        if(args.size() == 1)
+            return ints ? TInt : TUnknown;
+        for(auto t : args)
+            if(t != TInt) return TUnknown;
+        return TInt;
+    }
+    return TUnknown;
+}
+
+const std::set<std::string>& builtin_names() {
+    static const std::set<std::string> names = {"print", "flush", "len", "append", "pop", "extend", "insert", "range",
+                                                "list", "sorted", "min", "max", "sum", "abs", "str", "int", "snapshot",
+                                                "open_lines", "read_ints", "write_lines"};
+    return names;
+}
+
+struct TypeChecker {
+    std::vector<TypeDiagnostic> errors;
+    std::set<std::string> bound; // every name the program binds; these shadow the builtins
+    bool reporting = true;       // off while a loop body is iterated to its fixpoint
+
+    void check(const std::shared_ptr<Ast>& program) {
+        collect_bound(program);
+        TypeEnv env;
+        stmt(program, env);
+    }
+
+    void collect_bound(const std::shared_ptr<Ast>& node) {
+        switch(node->tag) {
+            case "assignment"_: case "list_create"_: case "for"_: case "list_comp"_:
+                bound.insert(node->nodes[node->tag == "list_comp"_ ? 1 : 0]->token_to_string());
+                break;
+            case "function"_:
+                for(size_t i = 0; i + 1 < node->nodes.size(); i++)
+                    bound.insert(node->nodes[i]->token_to_string());
+                break;
+        }
+        for(auto& child : node->nodes)
+            collect_bound(child);
+    }
+
+    void error(const std::shared_ptr<Ast>& at, const std::string& msg) {
+        if(reporting)
+            errors.push_back({at->line, at->column, "TypeError: " + msg});
+    }
+    void require_int(const std::shared_ptr<Ast>& at, Type t, const char* what) {
+        if(t != TUnknown && t != TInt)
+            error(at, std::string("unsupported operand type for ") + what + ": '" + type_name(t) + "'");
+    }
+
+    Type lookup(const std::string& name, const TypeEnv& env) const {
+        if(auto it = env.find(name); it != env.end())
+            return it->second;
+        if(!bound.count(name) && builtin_names().count(name))
+            return TFunction;
+        return TUnknown;
+    }
+    // Something may have stored non-ints into a list through its storage.
+    static void forget_int_lists(TypeEnv& env) {
+        for(auto& [name, t] : env)
+            if(t == TIntList) t = TList;
+    }
+
+    static void bind(TypeEnv& env, const std::string& name, Type t) {
+        if(t == TUnknown) env.erase(name);
+        else env[name] = t;
+    }
+    // A list variable is re-read on every step (see for_each_in), so its type at the loop head
+    // counts, including whatever the body stored into it.
+    Type iterable_type(const std::shared_ptr<Ast>& iterable, Type seq, const TypeEnv& env) const {
+        auto& nodes = iterable->nodes;
+        if(iterable->tag == "NAME"_)
+            return lookup(iterable->token_to_string(), env);
+        if(iterable->tag == "expression"_ && nodes.size() == 2 && nodes[0]->token.empty() && nodes[1]->tag == "NAME"_)
+            return lookup(nodes[1]->token_to_string(), env);
+        return seq;
+    }
+
+    Type item_type(const std::shared_ptr<Ast>& at, Type seq) {
+        switch(seq) {
+            case TIntList: case TRange: return TInt;
+            case TString: return TString;
+            case TInt: case TBool: case TNil: case TFunction:
+                error(at, std::string("'") + type_name(seq) + "' object is not iterable");
+                return TUnknown;
+            default: return TUnknown;
+        }
+    }
+
+    // Runs a loop body until the types at the loop head stop changing, then once more with
+    // reporting on so nodes are annotated and errors emitted against the fixpoint.
+    template<typename F>
+    void loop(TypeEnv& env, F&& body) {
+        bool saved = reporting;
+        reporting = false;
+        TypeEnv head = env;
+        bool stable = false;
+        for(int pass = 0; pass < 8 && !stable; pass++) {
+            TypeEnv out = head;
+            body(out);
+            TypeEnv next = join(env, out);
+            stable = next == head;
+            head = std::move(next);
+        }
+        if(!stable)
+            head.clear();
+        reporting = saved;
+        TypeEnv out = head;
+        body(out);
+        env = std::move(head); // the loop exits from its head
+    }
+
+    // Mirrors eval_compare: only the ordering operators constrain their operands, which must
+    // be two ints or two strings.
+    void compare(const std::shared_ptr<Ast>& node, TypeEnv& env) {
+        auto& nodes = node->nodes;
+        if(nodes.size() == 2) {
+            expr(nodes[1], env);
+            return;
+        }
+        Type lhs = expr(nodes[0], env);
+        Type rhs = expr(nodes[2], env);
+        auto oper = nodes[1]->token_to_string();
+        if(oper != "<" && oper != "<=" && oper != ">" && oper != ">=")
+            return;
+        for(auto [at, t] : {std::pair{nodes[0], lhs}, std::pair{nodes[2], rhs}})
+            if(t != TUnknown && t != TInt && t != TString)
+                error(at, std::string("unsupported operand type for comparison: '") + type_name(t) + "'");
+        if((lhs == TInt && rhs == TString) || (lhs == TString && rhs == TInt))
+            error(nodes[0], std::string("'") + oper + "' not supported between '" + type_name(lhs) + "' and '"
+                                + type_name(rhs) + "'");
+    }
+
+    void stmt(const std::shared_ptr<Ast>& node, TypeEnv& env) {
+        auto& nodes = node->nodes;
+        switch(node->tag) {
+            case "assignment"_:
+                env[nodes[0]->token_to_string()] = expr(nodes[1], env);
+                break;
+            case "list_create"_: {
+                bool ints = nodes.size() > 1; // `l = []` holds a nil placeholder
+                for(size_t i = 1; i < nodes.size(); i++)
+                    ints = expr(nodes[i], env) == TInt && ints;
+                env[nodes[0]->token_to_string()] = ints ? TIntList : TList;
+                break;
+            }
+            case "list_assign"_:
+                list_assign(node, env);
+                break;
+            case "function"_: {
+                env[nodes[0]->token_to_string()] = TFunction;
+                TypeEnv local; // parameters and outer names are unknown
+                stmt(nodes.back(), local);
+                break;
+            }
+            case "if"_: {
+                compare(nodes[0], env);
+                TypeEnv then = env;
+                stmt(nodes[1], then);
+                if(nodes.size() > 2)
+                    stmt(nodes[2], env);
+                env = join(then, env);
+                break;
+            }
+            case "while"_:
+                loop(env, [&](TypeEnv& e) {
+                    compare(nodes[0], e);
+                    stmt(nodes[1], e);
+                });
+                break;
+            case "for"_: {
+                Type seq = expr(nodes[1], env);
+                auto name = nodes[0]->token_to_string();
+                loop(env, [&](TypeEnv& e) {
+                    bind(e, name, item_type(nodes[1], iterable_type(nodes[1], seq, e)));
+                    stmt(nodes[2], e);
+                });
+                break;
+            }
+            case "call"_: case "return_stmt"_: case "expression"_:
+                expr(node, env);
+                break;
+            default:
+                for(auto& child : nodes)
+                    stmt(child, env);
+        }
+    }
+
+    void list_assign(const std::shared_ptr<Ast>& node, TypeEnv& env) {
+        auto& nodes = node->nodes;
+        auto name = nodes[0]->token_to_string();
+        Type target = lookup(name, env);
+        if(target != TUnknown && !is_list(target) && target != TDict)
+            error(nodes[0], std::string("'") + type_name(target) + "' object does not support item assignment");
+        Type value;
+        if(nodes[1]->tag == "list_splice"_) {
+            for(auto& bound : nodes[1]->nodes)
+                require_int(bound, expr(bound, env), "slice");
+            value = expr(nodes[2], env);
+            if(value != TUnknown && !is_list(value))
+                error(nodes[2], std::string("can only assign a list to a slice, not '") + type_name(value) + "'");
+            value = value == TIntList ? TInt : TUnknown;
+        } else {
+            Type key = expr(nodes[1], env);
+            if(is_list(target))
+                require_int(nodes[1], key, "list index");
+            value = expr(nodes[2], env);
+        }
+        if(target == TIntList && value != TInt)
+            env[name] = TList;
+    }
+
+    Type expr(const std::shared_ptr<Ast>& node, TypeEnv& env) {
+        Type t = infer(node, env);
+        node->type = t;
+        return t;
+    }
+
+    Type infer(const std::shared_ptr<Ast>& node, TypeEnv& env) {
+        auto& nodes = node->nodes;
+        switch(node->tag) {
+            case "NUMBER"_: return TInt;
+            case "STRING"_: return TString;
+            case "NAME"_: return lookup(node->token_to_string(), env);
+            case "expression"_: return expression(node, env);
+            case "term"_:
+                for(size_t i = 0; i < nodes.size(); i += 2)
+                    require_int(nodes[i], expr(nodes[i], env), nodes[i ? i - 1 : 1]->token_to_string().c_str());
+                return TInt;
+            case "call"_: return call(node, env);
+            case "list_value"_: return subscript(node, env);
+            case "raw_list"_: {
+                bool ints = true;
+                for(auto& item : nodes)
+                    ints = expr(item, env) == TInt && ints;
+                return ints ? TIntList : TList;
+            }
+            case "dict"_:
+                for(auto& item : nodes) {
+                    expr(item->nodes[0], env);
+                    expr(item->nodes[1], env);
+                }
+                return TDict;
+            case "list_comp"_: {
+                Type seq = expr(nodes[2], env);
+                auto name = nodes[1]->token_to_string();
+                bool had = env.count(name);
+                Type outer = had ? env[name] : TUnknown;
+                Type element = TUnknown;
+                loop(env, [&](TypeEnv& e) {
+                    bind(e, name, item_type(nodes[2], iterable_type(nodes[2], seq, e)));
+                    if(nodes.size() > 3)
+                        compare(nodes[3], e);
+                    element = expr(nodes[0], e);
+                });
+                // The variable lives in the comprehension's own scope.
+                if(had) env[name] = outer;
+                else env.erase(name);
+                return element == TInt ? TIntList : TList;
+            }
+            case "leftSp"_: case "rightSp"_:
+                return expr(nodes[0], env);
+        }
+        return nodes.empty() ? TUnknown : expr(nodes[0], env);
+    }
+
+    // Mirrors eval_expr_generic: the leading operand decides between int arithmetic, string
+    // concatenation and list concatenation. When the pass knows which one it is, the node is
+    // specialized now and, for a leading variable, marked `typed` so its guard is skipped.
+    Type expression(const std::shared_ptr<Ast>& node, TypeEnv& env) {
+        auto& nodes = node->nodes;
+        bool unsigned_ = nodes[0]->token.empty();
+        auto tag = nodes[1]->tag;
+        Type first = expr(nodes[1], env);
+        auto specialize = [&](Quick kind, bool typed) {
+            node->quick = kind;
+            node->typed = typed;
+        };
+
+        if(nodes.size() == 2 && ((unsigned_ && (tag == "dict"_ || tag == "list_comp"_ || tag == "NAME"_))
+                                 || tag == "call"_ || tag == "list_value"_ || tag == "STRING"_)) {
+            specialize(QExprValue, false);
+            return first;
+        }
+        if(tag == "raw_list"_) {
+            specialize(QExprRawList, false);
+            return concat(node, env, first);
+        }
+        if(tag == "NAME"_) {
+            if(is_list(first)) {
+                specialize(QExprList, true);
+                return concat(node, env, first);
+            }
+            if(first == TString) {
+                specialize(QExprString, true);
+                for(size_t i = 2; i < nodes.size(); i += 2) {
+                    Type t = expr(nodes[i + 1], env);
+                    if(nodes[i]->token[0] == '+' && t != TUnknown && t != TString)
+                        error(nodes[i + 1], std::string("can only concatenate string (not '") + type_name(t) + "') to string");
+                }
+                return TString;
+            }
+            if(first == TUnknown) { // left to the first run
+                specialize(QNone, false);
+                for(size_t i = 2; i < nodes.size(); i += 2)
+                    expr(nodes[i + 1], env);
+                return TUnknown;
+            }
+        }
+        specialize(QExprInt, tag == "NAME"_);
+        require_int(nodes[1], first, nodes.size() > 2 ? nodes[2]->token_to_string().c_str() : "unary -");
+        for(size_t i = 2; i < nodes.size(); i += 2)
+            require_int(nodes[i + 1], expr(nodes[i + 1], env), nodes[i]->token_to_string().c_str());
+        return TInt;
+    }
+
+    Type concat(const std::shared_ptr<Ast>& node, TypeEnv& env, Type first) {
+        auto& nodes = node->nodes;
+        bool ints = first == TIntList;
+        for(size_t i = 2; i < nodes.size(); i += 2) {
+            Type t = expr(nodes[i + 1], env);
+            if(nodes[i]->token[0] != '+')
+                continue; // concat_lists ignores the other operators
+            if(t != TUnknown && !is_list(t))
+                error(nodes[i + 1], std::string("can only concatenate list (not '") + type_name(t) + "') to list");
+            ints = ints && t == TIntList;
+        }
+        return ints ? TIntList : TList;
+    }
+
+    Type call(const std::shared_ptr<Ast>& node, TypeEnv& env) {
+        auto& nodes = node->nodes;
+        auto fn = nodes[0]->token_to_string();
+        Type callee = lookup(fn, env);
+        if(callee != TUnknown && callee != TFunction)
+            error(nodes[0], std::string("'") + type_name(callee) + "' object is not callable");
+
+        std::vector<Type> args;
+        for(size_t i = 1; i < nodes.size(); i++)
+            args.push_back(expr(nodes[i], env));
+
+        bool builtin = callee == TFunction && !bound.count(fn) && builtin_names().count(fn);
+        if(!builtin) {
+            forget_int_lists(env);
+            return TUnknown;
+        }
+        // The list mutators take the variable itself; track what they store into it.
+        if(fn == "append" || fn == "extend" || fn == "insert" || fn == "pop") {
+            if(!args.empty() && args[0] != TUnknown && !is_list(args[0]))
+                error(nodes[1], fn + "() expects a list, not '" + type_name(args[0]) + "'");
+            Type stored = fn == "append" ? args.back()
+                        : fn == "insert" ? args.back()
+                        : fn == "extend" ? (args.back() == TIntList || args.back() == TRange ? TInt : TUnknown)
+                        : TInt;
+            if(args.size() > 1 && args[0] == TIntList && stored != TInt && nodes[1]->tag == "NAME"_)
+                env[nodes[1]->token_to_string()] = TList;
+        }
+        return builtin_result(fn, args);
+    }
+
+    Type subscript(const std::shared_ptr<Ast>& node, TypeEnv& env) {
+        auto& nodes = node->nodes;
+        Type base = lookup(nodes[0]->token_to_string(), env);
+        nodes[0]->type = base;
+        bool splice = nodes[1]->tag == "list_splice"_;
+        if(splice) {
+            for(auto& bound : nodes[1]->nodes)
+                require_int(bound, expr(bound, env), "slice");
+        } else {
+            Type key = expr(nodes[1], env);
+            if(is_list(base) || base == TRange)
+                require_int(nodes[1], key, "index");
+        }
+        if(base == TUnknown)
+            return TUnknown;
+        if(!is_list(base) && (splice || base != TDict) && (splice || base != TRange)) {
+            error(nodes[0], std::string("'") + type_name(base) + "' object is not subscriptable");
+            return TUnknown;
+        }
+        if(splice)
+            return base;
+        return base == TIntList || base == TRange ? TInt : TUnknown;
+    }
+};
@@ -0,0 +1,53 @@
+// Dict lookups against the parallel-list linear scan that scripts used before dicts existed.
+// Build from this directory: g++ -std=c++17 -O2 dict_bench.cpp -o dict_bench
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+#include "../Interpreter.hpp"
+
+template<typename F>
+double ns_per_op(size_t ops, F&& f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / ops;
+}
+
+int main() {
+    std::printf("%8s %12s %12s %9s\n", "entries", "scan ns/op", "dict ns/op", "speedup");
+    for(long n : {16L, 256L, 4096L, 65536L}) {
+        List keys, values;
+        Dict dict;
+        for(long i = 0; i < n; i++) {
+            Value key("key" + std::to_string(i));
+            keys.push_back(key);
+            values.push_back(Value(i));
+            dict[key] = Value(i);
+        }
+
+        size_t lookups = std::max<size_t>(2000, (1 << 24) / n);
+        long scanSum = 0, dictSum = 0;
+        double scan = ns_per_op(lookups, [&] {
+            for(size_t q = 0; q < lookups; q++) {
+                auto& key = keys[(q * 7919) % n];
+                for(size_t j = 0; j < keys.size(); j++) {
+                    if(same_value(keys[j], key)) {
+                        scanSum += std::get<long>(values[j].v);
+                        break;
+                    }
+                }
+            }
+        });
+        double hashed = ns_per_op(lookups, [&] {
+            for(size_t q = 0; q < lookups; q++)
+                dictSum += std::get<long>(dict.find(keys[(q * 7919) % n])->v);
+        });
+        if(scanSum != dictSum) {
+            std::fprintf(stderr, "lookup mismatch at n=%ld\n", n);
+            return EXIT_FAILURE;
+        }
+        std::printf("%8ld %12.1f %12.1f %8.1fx\n", n, scan, hashed, scan / hashed);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,169 @@
+// Parse throughput and memory against script size. Programs are generated from a mix of defs
+// with nested blocks, loops, list and dict expressions and comments, repeated up to each size.
+// A second set of runs parses brackets nested to each depth, which has to stay linear (see the
+// *Ahead rules in Grammar.hpp). Every run happens in a forked child so its peak RSS is its own;
+// each prints one JSON object per line:
+//   {"bytes":..., "nesting":0 or depth, "parsed":true, "seconds":..., "mb_per_sec":... or null,
+//    "rss_before_kb":..., "peak_rss_kb":...}
+// rss_before_kb is the peak before parsing, with the generated source in memory. Peak RSS is
+// about 200x the source, so sizes that would not fit in physical memory are skipped with a
+// warning. There is no packrat run: the indentation hooks make rule results depend on state the
+// memo table ignores (see Grammar.hpp), so this grammar doesn't parse with it.
+// Build from this directory: g++ -std=c++17 -O2 parse_bench.cpp -o parse_bench
+// Usage: parse_bench [--sizes=10K,100K,1M,10M,100M] [--nesting=8,16,32]
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../Grammar.hpp"
+
+// One unit of the synthetic program; `n` keeps its names apart from the other units.
+void append_unit(std::string& out, size_t n) {
+    auto i = std::to_string(n);
+    out += "# helper " + i + ": folds a short list into a running value\n"
+           "def f" + i + "(a, b):\n"
+           "    c = a * 3 + b\n"
+           "    if c > 100:\n"
+           "        while (c > 10):\n"
+           "            c = c - 7   # step down\n"
+           "    else:\n"
+           "        c = c + 1\n"
+           "    l = [a, b, c]\n"
+           "    for x in l:\n"
+           "        if x > 2:\n"
+           "            c = c + x\n"
+           "    return c\n"
+           "\n"
+           "v" + i + " = f" + i + "(1, 2)\n"
+           "data" + i + " = [1, 2, 3, v" + i + "]\n"
+           "sq" + i + " = [x * x for x in data" + i + " if x > 1]\n"
+           "d" + i + " = {\"k\": v" + i + ", \"n\": 4}\n"
+           "print(v" + i + ", sq" + i + "[1], d" + i + "[\"k\"])\n"
+           "\n";
+}
+
+std::string generate(size_t bytes) {
+    std::string out;
+    out.reserve(bytes + 1024);
+    for(size_t n = 0; out.size() < bytes; n++)
+        append_unit(out, n);
+    return out;
+}
+
+// A list literal, a comprehension over one and a subscript, each `depth` brackets deep.
+std::string generate_nested(size_t depth) {
+    std::string open(depth, '['), close(depth, ']'), index;
+    for(size_t i = 0; i < depth; i++)
+        index += "l[";
+    return "l = [0]\n"
+           "x = " + open + "1" + close + "\n"
+           "y = [" + open + "z" + close + " for z in x]\n"
+           "v = " + index + "0" + close + "\n";
+}
+
+long peak_rss_kb() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// Runs in the forked child.
+void measure(size_t bytes, size_t nesting) {
+    peg::parser parser(minipython_grammar);
+    if(!parser) {
+        std::fprintf(stderr, "grammar failed to load\n");
+        _exit(EXIT_FAILURE);
+    }
+    install_hooks(parser);
+    parser.enable_ast<Ast>();
+    std::string source = nesting ? generate_nested(nesting) : generate(bytes);
+    long before = peak_rss_kb();
+
+    std::shared_ptr<Ast> ast;
+    auto start = std::chrono::steady_clock::now();
+    bool parsed = parser.parse(source, ast);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    long peak = peak_rss_kb();
+
+    char rate[32] = "null"; // a failed parse stops early, its rate means nothing
+    if(parsed)
+        std::snprintf(rate, sizeof(rate), "%.3f", source.size() / 1e6 / seconds);
+    std::printf("{\"bytes\":%zu, \"nesting\":%zu, \"parsed\":%s, \"seconds\":%.6f, \"mb_per_sec\":%s, "
+                "\"rss_before_kb\":%ld, \"peak_rss_kb\":%ld}\n",
+                source.size(), nesting, parsed ? "true" : "false", seconds, rate, before, peak);
+    std::fflush(stdout);
+}
+
+size_t parse_size(const std::string& s) {
+    size_t pos = 0, n = std::stoul(s, &pos);
+    char unit = pos < s.size() ? s[pos] : ' ';
+    return unit == 'K' || unit == 'k' ? n << 10 : unit == 'M' || unit == 'm' ? n << 20 : n;
+}
+
+std::vector<std::string> split(const std::string& s) {
+    std::vector<std::string> parts;
+    for(size_t start = 0; start <= s.size();) {
+        size_t end = std::min(s.find(',', start), s.size());
+        if(end > start) // so an empty list, e.g. --nesting=, turns those runs off
+            parts.push_back(s.substr(start, end - start));
+        start = end + 1;
+    }
+    return parts;
+}
+
+// Measures one run in a forked child; false if it didn't finish.
+bool run(size_t bytes, size_t nesting) {
+    pid_t pid = fork();
+    if(pid == 0) {
+        measure(bytes, nesting);
+        _exit(EXIT_SUCCESS);
+    }
+    int child = 0;
+    waitpid(pid, &child, 0);
+    if(WIFEXITED(child) && WEXITSTATUS(child) == EXIT_SUCCESS)
+        return true;
+    std::fprintf(stderr, "run at %zu bytes, nesting %zu did not finish\n", bytes, nesting);
+    return false;
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<size_t> sizes = {10 << 10, 100 << 10, 1 << 20};
+    std::vector<size_t> depths = {8, 16, 32};
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if(arg.rfind("--sizes=", 0) == 0) {
+            sizes.clear();
+            for(auto& s : split(arg.substr(8)))
+                sizes.push_back(parse_size(s));
+        } else if(arg.rfind("--nesting=", 0) == 0) {
+            depths.clear();
+            for(auto& d : split(arg.substr(10)))
+                depths.push_back(std::stoul(d));
+        } else {
+            std::fprintf(stderr, "usage: %s [--sizes=10K,100K,1M,10M,100M] [--nesting=8,16,32]\n"
+                                 "  peak RSS is about 200x the size; sizes that don't fit in memory are skipped\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    size_t memory = (size_t) sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE);
+    int status = EXIT_SUCCESS;
+    for(auto bytes : sizes) {
+        if(bytes * 200 > memory) { // the tree takes ~200x the source
+            std::fprintf(stderr, "skipping %zu bytes: needs about %zu MB, more than the %zu MB of memory\n", bytes,
+                         bytes * 200 >> 20, memory >> 20);
+            status = EXIT_FAILURE;
+            continue;
+        }
+        if(!run(bytes, 0))
+            status = EXIT_FAILURE;
+    }
+    for(auto depth : depths)
+        if(!run(0, depth))
+            status = EXIT_FAILURE;
+    return status;
+}
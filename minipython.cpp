@@ -2,136 +2,248 @@
 #include <memory>
 #include <fstream>
 #include <string>
+#include <unistd.h>
 
 #include "Include/peglib.h"
 #include "Interpreter.hpp"
-#include "Indent.hpp"
+#include "TypeCheck.hpp"
+#include "Inline.hpp"
+#include "Grammar.hpp"
+#include "AstCache.hpp"
+#include "MappedFile.hpp"
+#include "Pipeline.hpp"
+#include "Server.hpp"
+#include "Snapshot.hpp"
 
 #define CERROR(cond,str) if(cond){std::cerr<<str<<std::endl;return EXIT_FAILURE;}
 
 int main(int argc, char* argv[]) {
-    if(argc < 2) {
-        std::cerr << argv[0] << " {file}.py" << std::endl;
+    const char* src = nullptr;
+    std::string profilePath;
+    std::string statsPath;
+    bool reportResources = false;
+    bool typecheck = true;
+    bool inlining = true;
+    bool useCache = true;
+    bool stream = false;
+    bool lazy = false;
+    std::string inlineProfilePath;
+    std::string servePath, clientPath;
+    std::string snapshotPath;
+    std::vector<std::string> runOptions; // forwarded by --client
+    FlushPolicy flush = isatty(STDOUT_FILENO) ? FlushPolicy::Line : FlushPolicy::Block;
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if(arg == "--profile")
+            profilePath = "profile.folded";
+        else if(arg.rfind("--profile=", 0) == 0)
+            profilePath = arg.substr(10);
+        else if(arg == "--stats")
+            statsPath = "stats.json";
+        else if(arg.rfind("--stats=", 0) == 0)
+            statsPath = arg.substr(8);
+        else if(apply_run_option(arg, flush, resources.limits))
+            runOptions.push_back(arg);
+        else if(arg == "--serve" && i + 1 < argc)
+            servePath = argv[++i];
+        else if(arg == "--client" && i + 1 < argc)
+            clientPath = argv[++i];
+        else if(arg == "--no-cache")
+            useCache = false;
+        else if(arg == "--stream")
+            stream = true;
+        else if(arg == "--lazy")
+            lazy = true;
+        else if(arg.rfind("--snapshot=", 0) == 0)
+            snapshotPath = arg.substr(11);
+        else if(arg == "--no-inline")
+            inlining = false;
+        else if(arg.rfind("--inline-profile=", 0) == 0)
+            inlineProfilePath = arg.substr(17);
+        else if(arg == "--no-typecheck")
+            typecheck = false;
+        else if(arg == "--resources")
+            reportResources = true;
+        else
+            src = argv[i];
+    }
+    if(!servePath.empty())
+        return Server(typecheck, inlining, flush, resources.limits).serve(servePath);
+    if(!clientPath.empty() && src)
+        return run_client(clientPath, runOptions, src);
+    if(src == nullptr) {
+        std::cerr << argv[0] << " [--profile[=out.folded]] [--stats[=stats.json]] [--resources] [--no-typecheck]"
+                  << " [--no-inline] [--inline-profile=profile.folded] [--no-cache] [--stream] [--lazy] [--snapshot=setup.snap]"
+                  << " [--max-cpu-ms=N] [--max-heap=BYTES] [--max-list=N]"
+                  << " [--flush=line|block|explicit] {file}.py" << std::endl;
+        std::cerr << argv[0] << " --serve {socket} [--no-typecheck] [--no-inline] [--max-...] [--flush=...]" << std::endl;
+        std::cerr << argv[0] << " --client {socket} [--max-...] [--flush=...] {file}.py|-" << std::endl;
         return EXIT_FAILURE;
     }
-    auto src = argv[1];
-    std::ifstream inputStream(src, std::ios::in);
+    // Items run as they're parsed, so there is no whole program to cache or analyze, and the
+    // parser is busy on this thread when the interpreter thread would need it for a body.
+    if(stream)
+        useCache = inlining = typecheck = lazy = false;
+    // Unparsed bodies would hide bindings from the whole-program passes, and a cached tree's
+    // lazy_block text wouldn't point into the source.
+    if(lazy)
+        useCache = inlining = typecheck = false;
+    // A snapshot holds the whole program tree its functions come from, bodies included.
+    if(!snapshotPath.empty())
+        stream = lazy = false;
+    stats.enabled = !statsPath.empty();
+    auto writeStats = [&]() {
+        if(stats.enabled) {
+            std::ofstream statsFile(statsPath, std::ios::out);
+            stats.write_json(statsFile);
+        }
+    };
+    auto phaseStart = Stats::now();
+
     std::ofstream traceFile("trace.log", std::ios::out);
     std::ofstream varHistFile("varhistory.log", std::ios::out);
     std::ofstream errorFile("error.log", std::ios::out);
     traceFile << "Source argument: " << src << std::endl;
-    
-    // Define grammar.
-    // https://bford.info/pub/lang/peg.pdf
-    auto grammar = (R"(
-        program         <- (NEWLINE / Comment / function / stmt / indent_block)+ EOF
-        
-        indent_block    <- NEWLINE* _ '{' block NEWLINE* _ '}' NEWLINE* 
-        block           <-  (indent_block / statement)+ { no_ast_opt }
-        function        <- ('def' __ NAME __'(' _ Args(NAME)? ')' __ ':' indent_block)
 
-        stmt            <- (while / if / Comment / list_expr / assignment / call) ';'?
-        statement       <- NEWLINE? Samedent (while / if / NEWLINE / Comment / list_expr / assignment / call / return_stmt) ';'?
-
-        list_expr       <- list_assign / list_create
-        list_assign     <- (NAME '[' _ (list_op / expression) _ ']' _ '=' _ expression)
-        list_create     <- NAME '=' _ '[' _ Args(expression)? ']' _ !term_op { no_ast_opt }
-        assignment      <- NAME '=' _ expression
-        call            <- NAME '(' _ Args(call / VALUE / expression)? ')' _ { no_ast_opt }
-
-        if              <- 'if' __ compare ':' _ indent_block _ ('else' ':' indent_block)?
-        compare         <-  (compare_prefix VALUE) / ((VALUE compare_infix ' '* VALUE)) / ('(' (VALUE compare_infix ' '* VALUE) ')')
-        compare_prefix  <- 'not'
-        compare_infix   <- '==' / '<=' / '>=' / '<' / '>' / 'and' / 'or'
+    // The script is parsed straight from a read-only mapping, so tokens point into it and the
+    // source is never copied; `input` outlives the AST.
+    MappedFile input;
+    CERROR(!input.open(src), "Could not open source file");
+    std::string_view raw = input.view();
+    phaseStart = stats.phase("read", phaseStart);
+
+    // An unchanged script (and grammar) skips the grammar build, parsing and
+    // optimize_ast altogether; its tree's tokens then point into the mapped cache file.
+    uint64_t sourceHash = ast_cache::fnv1a(raw, ast_cache::fnv1a(minipython_grammar));
+    std::string cachePath = ast_cache::path_for(src, sourceHash);
+    MappedFile cacheFile;
+    peg::parser parser;
+    std::string syntaxErrors;
+    auto reportSyntaxErrors = [&]() {
+        errorFile << syntaxErrors << "Syntax error, could not parse" << std::endl;
+        std::cerr << syntaxErrors;
+    };
+    std::shared_ptr<Ast> ast;
+    if(useCache && cacheFile.open(cachePath)) {
+        ast = ast_cache::load(cacheFile, sourceHash);
+        phaseStart = stats.phase("cache_load", phaseStart);
+    }
+    if(!ast) {
+        parser.load_grammar(minipython_grammar);
+        phaseStart = stats.phase("grammar", phaseStart);
 
-        while           <- 'while' __ '(' _ compare _ ')' _ ':'  indent_block
-        return_stmt     <- 'return' _ expression { no_ast_opt }
+        CERROR(parser!=true, "Could not generate a parser from defined grammar.");
+        install_hooks(parser, lazy);
 
-        expression      <- sign term (term_op term)*
-        sign            <- < [-+]? > _
-        term_op         <- < [-+] > _
-        term            <- factor (factor_op factor)*
-        factor_op       <- < [*/] > _
-        factor          <- VALUE / '(' _ expression ')' _
-        VALUE           <- raw_list / list_value / call / STRING / NAME / NUMBER
-        
-        raw_list        <- _ '[' _ Args(expression / VALUE)? ']' _ { no_ast_opt }
-        list_value      <- NAME '[' _ (':'/ list_op) ']' _
-        list_op         <- list_splice / NUMBER / NAME
-        list_splice     <- leftSp? ':' rightSp? { no_ast_opt }
-        leftSp          <- expression { no_ast_opt }
-        rightSp         <- expression { no_ast_opt }
+        traceFile << "---- BEG INPUT ----" << std::endl;
+        traceFile << raw << std::endl;
+        traceFile << "---- END INPUT ----" << std::endl;
         
-        
-        keyword         <- 'while' / 'if' / 'def'
-        
-        STRING          <- '"' < (!'"' .)* > '"'
-        NAME            <- !keyword < [a-zA-Z] [a-zA-Z0-9]* > _
-        NUMBER          <- < [0-9]+ > _
-
-
-        ~Samedent        <- (' ')* {}
-        Args(x)         <- x _ (',' _ x)*
-        ~Comment        <- '#' [^\r\n]* _
-        ~NEWLINE        <- [\r\n]+
-        ~_              <- [ \t]*
-        ~__             <- ![a-z0-9_] _
-        ~EOF            <- !.
-    )");
-
-
-    peg::parser parser(grammar);
-
-    // size_t indent = 0;
-    // parser["block"].enter = [&](const Context & /*c*/, const char * /*s*/,
-    //                             size_t /*n*/, std::any & /*dt*/) { indent += 2; };
-
-    // parser["block"].leave = [&](const Context & /*c*/, const char * /*s*/,
-    //                             size_t /*n*/, size_t /*matchlen*/,
-    //                             std::any & /*value*/,
-    //                             std::any & /*dt*/) { indent -= 2; };
-
-    // parser["Samedent"].predicate =
-    //     [&](const SemanticValues &vs, const std::any & /*dt*/, std::string &msg) {
-    //         if (indent != vs.sv().size()) {
-    //         msg = "different indent...";
-    //         return false;
-    //         }
-    //         return true;
-    //     };
-
-    CERROR(parser!=true, "Could not generate a parser from defined grammar.");
-    CERROR(inputStream.fail(), "Could not open source file");
-
-    std::stringstream buffer;
-    buffer << inputStream.rdbuf();
-    std::string source = pythonCFL(buffer.str());
-    traceFile << "---- BEG INPUT ----" << std::endl;
-    traceFile << source << std::endl;
-    traceFile << "---- END INPUT ----" << std::endl;
-    
-    parser.set_logger([&](size_t line, size_t col, const std::string& msg, const std::string &rule) {
-        std::string errMsg = std::to_string(line) + ":" + std::to_string(col) + ": " + msg + " | rule: " + rule + "\n";
-        errorFile << errMsg;
-        std::cerr << errMsg;
-    });
-
-    parser.enable_ast();
-    parser.enable_packrat_parsing();
-    std::shared_ptr<peg::Ast> ast;
-    if(parser.parse(source, ast)) {
-        ast = parser.optimize_ast(ast);
+        // Held back until parsing is over; under --stream the interpreter thread may be
+        // writing error.log meanwhile.
+        parser.set_logger([&](size_t line, size_t col, const std::string& msg, const std::string &rule) {
+            syntaxErrors += std::to_string(line) + ":" + std::to_string(col) + ": " + msg + " | rule: " + rule + "\n";
+        });
+
+        parser.enable_ast<Ast>();
+        if(lazy) {
+            parseLazyBody = [&](const Ast& body) {
+                syntaxErrors.clear();
+                auto block = parse_lazy_body(parser, body);
+                if(!block)
+                    throw std::runtime_error("SyntaxError: " + syntaxErrors.substr(0, syntaxErrors.find('\n')));
+                return block;
+            };
+        }
+        if(!stream) {
+            // No packrat parsing: the indentation hooks need it off, and the grammar's lookahead
+            // scans keep nested brackets linear without it (see Grammar.hpp).
+            bool parsed = parser.parse(raw, ast);
+            phaseStart = stats.phase("parse", phaseStart);
+            if(!parsed) {
+                reportSyntaxErrors();
+                writeStats();
+                return EXIT_FAILURE;
+            }
+            ast = parser.optimize_ast(ast);
+            phaseStart = stats.phase("optimize_ast", phaseStart);
+            if(useCache) {
+                ast_cache::save(cachePath, sourceHash, *ast);
+                phaseStart = stats.phase("cache_store", phaseStart);
+            }
+        }
+    } else {
+        traceFile << "---- CACHED " << cachePath << " ----" << std::endl;
+    }
+    if(inlining) {
+        Inliner inliner;
+        if(!inlineProfilePath.empty()) {
+            std::ifstream profileFile(inlineProfilePath, std::ios::in);
+            CERROR(profileFile.fail(), "Could not open inline profile");
+            inliner.options.calls = read_profile_counts(profileFile);
+        }
+        stats.inlined = inliner.run(ast);
+        phaseStart = stats.phase("inline", phaseStart);
+    }
+    if(ast) {
         traceFile << peg::ast_to_s(ast);
         traceFile << "----" << std::endl;
-        try {
-            interpret(ast, std::cout, traceFile, varHistFile, errorFile);
-        } catch(const std::exception& e) {
-            std::cerr << e.what() << std::endl;
-            errorFile << e.what() << std::endl;
+    }
+    if(typecheck) {
+        TypeChecker checker;
+        checker.check(ast);
+        phaseStart = stats.phase("typecheck", phaseStart);
+        for(auto& e : checker.errors) {
+            std::string errMsg = std::to_string(e.line) + ":" + std::to_string(e.column) + ": " + e.message;
+            errorFile << errMsg << std::endl;
+            std::cerr << errMsg << std::endl;
+        }
+        if(!checker.errors.empty()) {
+            writeStats();
             return EXIT_FAILURE;
         }
-        return EXIT_SUCCESS;
     }
-    errorFile << "Syntax error, could not parse" << std::endl;
-    return EXIT_FAILURE;
+    if(!profilePath.empty())
+        profiler.start(1000);
+    int status = EXIT_SUCCESS;
+    MappedFile snapshotFile; // restored function bodies point into it
+    try {
+        Interpreter interp(std::cout, traceFile, varHistFile, errorFile, flush);
+        long resume = -1;
+        if(!snapshotPath.empty()) {
+            if(snapshotFile.open(snapshotPath))
+                resume = restore_snapshot(interp, snapshotFile, raw);
+            if(resume >= (long) ast->nodes.size())
+                resume = -1;
+            enable_snapshots(interp, snapshotPath, ast, raw);
+            phaseStart = stats.phase("snapshot_restore", phaseStart);
+        }
+        if(resume >= 0) {
+            traceFile << "---- RESUMED AFTER ITEM " << resume << " ----" << std::endl;
+            for(size_t i = resume + 1; i < ast->nodes.size(); i++)
+                if(!interp.run_item(ast->nodes[i]))
+                    break;
+        } else if(!stream)
+            interp.run(ast);
+        else if(!run_pipelined(parser, raw, interp).parsed) {
+            reportSyntaxErrors();
+            status = EXIT_FAILURE;
+        }
+    } catch(const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        errorFile << e.what() << std::endl;
+        status = EXIT_FAILURE;
+    }
+    phaseStart = stats.phase("interpret", phaseStart);
+    traceFile << "---- RESOURCES ----" << std::endl;
+    resources.report(traceFile);
+    if(reportResources)
+        resources.report(std::cerr);
+    writeStats();
+    if(!profilePath.empty()) {
+        profiler.stop();
+        std::ofstream profileFile(profilePath, std::ios::out);
+        profiler.write_folded(profileFile);
+    }
+    return status;
 }
\ No newline at end of file
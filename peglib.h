@@ -920,29 +920,50 @@ public:
   bool is_traceable(const Ope &ope) const;
 
   // Line info
-  std::pair<size_t, size_t> line_info(const char *cur) const {
-    std::call_once(source_line_index_init_, [this]() {
-      for (size_t pos = 0; pos < l; pos++) {
-        if (s[pos] == '\n') { source_line_index.push_back(pos); }
-      }
-      source_line_index.push_back(l);
-    });
+  //
+  // Newlines are indexed on demand from the position parsing started at, and only as far as
+  // the furthest position asked about, so parsing a prefix of a long input doesn't scan the
+  // rest of it. The line of that start position is given by set_line_origin().
+  void set_line_origin(size_t pos, size_t line) {
+    origin_pos = pos;
+    origin_line = line;
+    origin_line_begin = pos;
+    while (origin_line_begin > 0 && s[origin_line_begin - 1] != '\n') {
+      origin_line_begin--;
+    }
+    source_line_index.clear();
+    source_line_index_end = pos;
+  }
 
+  std::pair<size_t, size_t> line_info(const char *cur) const {
     auto pos = static_cast<size_t>(std::distance(s, cur));
+    if (pos < origin_pos) { return peg::line_info(s, cur); }
+
+    while (source_line_index_end < l &&
+           (source_line_index.empty() || source_line_index.back() < pos)) {
+      if (s[source_line_index_end] == '\n') {
+        source_line_index.push_back(source_line_index_end);
+      }
+      source_line_index_end++;
+    }
 
     auto it = std::lower_bound(
         source_line_index.begin(), source_line_index.end(), pos,
         [](size_t element, size_t value) { return element < value; });
 
     auto id = static_cast<size_t>(std::distance(source_line_index.begin(), it));
-    auto off = pos - (id == 0 ? 0 : source_line_index[id - 1] + 1);
-    return std::pair(id + 1, off + 1);
+    auto off =
+        pos - (id == 0 ? origin_line_begin : source_line_index[id - 1] + 1);
+    return std::pair(origin_line + id, off + 1);
   }
 
   size_t next_trace_id = 0;
   std::vector<size_t> trace_ids;
   bool ignore_trace_state = false;
-  mutable std::once_flag source_line_index_init_;
+  size_t origin_pos = 0;
+  size_t origin_line = 1;
+  size_t origin_line_begin = 0;
+  mutable size_t source_line_index_end = 0;
   mutable std::vector<size_t> source_line_index;
 };
 
@@ -2229,6 +2250,23 @@ public:
     return parse_and_get_value(s, n, val, path, log);
   }
 
+  // Parses from s + offset, a position on line `line` of [s, s + n), and stops
+  // wherever the rule does instead of requiring the end of input; Result::len is
+  // the length consumed from offset.
+  template <typename T>
+  Result parse_prefix_and_get_value(const char *s, size_t n, size_t offset,
+                                    size_t line, T &val,
+                                    const char *path = nullptr,
+                                    Log log = nullptr) const {
+    SemanticValues vs;
+    std::any dt;
+    auto r = parse_core(s, n, vs, dt, path, log, offset, line, true);
+    if (r.ret && !vs.empty() && vs.front().has_value()) {
+      val = std::any_cast<T>(vs[0]);
+    }
+    return r;
+  }
+
   template <typename T>
   Result parse_and_get_value(const char *s, size_t n, std::any &dt, T &val,
                              const char *path = nullptr,
@@ -2378,7 +2416,8 @@ private:
   }
 
   Result parse_core(const char *s, size_t n, SemanticValues &vs, std::any &dt,
-                    const char *path, Log log) const {
+                    const char *path, Log log, size_t offset = 0,
+                    size_t line = 1, bool prefix = false) const {
     initialize_definition_ids();
 
     std::shared_ptr<Ope> ope = holder_;
@@ -2392,8 +2431,9 @@ private:
     Context c(path, s, n, definition_ids_.size(), whitespaceOpe, wordOpe,
               enablePackratParsing, tracer_enter, tracer_leave, trace_data,
               verbose_trace, log);
+    if (offset) { c.set_line_origin(offset, line); }
 
-    size_t i = 0;
+    size_t i = offset;
 
     if (whitespaceOpe) {
       auto save_ignore_trace_state = c.ignore_trace_state;
@@ -2401,17 +2441,19 @@ private:
       auto se =
           scope_exit([&]() { c.ignore_trace_state = save_ignore_trace_state; });
 
-      auto len = whitespaceOpe->parse(s, n, vs, c, dt);
-      if (fail(len)) { return Result{false, c.recovered, i, c.error_info}; }
+      auto len = whitespaceOpe->parse(s + i, n - i, vs, c, dt);
+      if (fail(len)) {
+        return Result{false, c.recovered, i - offset, c.error_info};
+      }
 
-      i = len;
+      i += len;
     }
 
     auto len = ope->parse(s + i, n - i, vs, c, dt);
     auto ret = success(len);
     if (ret) {
       i += len;
-      if (eoi_check) {
+      if (eoi_check && !prefix) {
         if (i < n) {
           if (c.error_info.error_pos - c.s < s + i - c.s) {
             c.error_info.message_pos = s + i;
@@ -2421,7 +2463,7 @@ private:
         }
       }
     }
-    return Result{ret, c.recovered, i, c.error_info};
+    return Result{ret, c.recovered, i - offset, c.error_info};
   }
 
   std::shared_ptr<Holder> holder_;
@@ -4537,6 +4579,23 @@ public:
     return false;
   }
 
+  // Parses `rule` from s + offset, a position on line `line`, without requiring it
+  // to reach the end of [s, s + n); on success `len` is the length consumed.
+  // Lines and errors are reported relative to s while only the part parsed gets
+  // scanned, so a long input can be parsed one item at a time.
+  template <typename T>
+  bool parse_prefix(const char *rule, const char *s, size_t n, size_t offset,
+                    size_t line, T &val, size_t &len,
+                    const char *path = nullptr) const {
+    if (grammar_ != nullptr) {
+      auto result = grammar_->at(rule).parse_prefix_and_get_value(
+          s, n, offset, line, val, path, log_);
+      len = result.len;
+      return post_process(s, n, result);
+    }
+    return false;
+  }
+
   bool parse(std::string_view sv, const char *path = nullptr) const {
     return parse_n(sv.data(), sv.size(), path);
   }